@@ -24,10 +24,21 @@
 #include "fishhook.h"
 
 #include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <mach/mach.h>
 #include <mach/vm_map.h>
@@ -35,6 +46,12 @@
 #include <mach-o/dyld.h>
 #include <mach-o/loader.h>
 #include <mach-o/nlist.h>
+#ifndef __has_feature
+#define __has_feature(x) 0
+#endif
+#if __has_feature(ptrauth_calls)
+#include <ptrauth.h>
+#endif
 
 #ifdef __LP64__
 typedef struct mach_header_64 mach_header_t;
@@ -42,48 +59,452 @@ typedef struct segment_command_64 segment_command_t;
 typedef struct section_64 section_t;
 typedef struct nlist_64 nlist_t;
 #define LC_SEGMENT_ARCH_DEPENDENT LC_SEGMENT_64
+#define MH_MAGIC_ARCH_DEPENDENT MH_MAGIC_64
 #else
 typedef struct mach_header mach_header_t;
 typedef struct segment_command segment_command_t;
 typedef struct section section_t;
 typedef struct nlist nlist_t;
 #define LC_SEGMENT_ARCH_DEPENDENT LC_SEGMENT
+#define MH_MAGIC_ARCH_DEPENDENT MH_MAGIC
 #endif
 
-#ifndef SEG_DATA_CONST
-#define SEG_DATA_CONST  "__DATA_CONST"
+#ifndef SG_READ_ONLY
+#define SG_READ_ONLY    0x10
 #endif
 
+/*
+ * All of fishhook's own data lives in mmap-backed bump arenas rather than on
+ * the malloc heap, so that malloc/free can themselves be rebound, and hooks can
+ * be installed from inside a malloc hook, without reentering the allocator.
+ */
+struct arena_chunk {
+    struct arena_chunk *next;
+    size_t size;                    // 整个 chunk 的映射大小，含头部
+    size_t used;
+};
+
+struct arena {
+    struct arena_chunk *chunks;     // 当前 chunk 在表头
+};
+
+#define ARENA_CHUNK_SIZE (64 * 1024)
+#define ARENA_ALIGNMENT 16
+
+static size_t arena_round_up(size_t size, size_t alignment) {
+    return (size + alignment - 1) & ~(alignment - 1);
+}
+
+// 返回的内存总是清零的：chunk 来自匿名映射，且只增不复用
+static void *arena_alloc(struct arena *arena, size_t size) {
+    size_t header_size = arena_round_up(sizeof(struct arena_chunk), ARENA_ALIGNMENT);
+    size = arena_round_up(size ? size : 1, ARENA_ALIGNMENT);
+    struct arena_chunk *chunk = arena->chunks;
+    if (!chunk || chunk->size - chunk->used < size) {
+        size_t page_size = (size_t)getpagesize();
+        size_t chunk_size = arena_round_up(header_size + size > ARENA_CHUNK_SIZE ? header_size + size : ARENA_CHUNK_SIZE, page_size);
+        void *memory = mmap(NULL, chunk_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+        if (memory == MAP_FAILED) {
+            return NULL;
+        }
+        chunk = (struct arena_chunk *)memory;
+        chunk->size = chunk_size;
+        chunk->used = header_size;
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+    }
+    void *result = (char *)chunk + chunk->used;
+    chunk->used += size;
+    return result;
+}
+
+static void arena_release(struct arena *arena) {
+    struct arena_chunk *chunk = arena->chunks;
+    while (chunk) {
+        struct arena_chunk *next = chunk->next;
+        munmap(chunk, chunk->size);
+        chunk = next;
+    }
+    arena->chunks = NULL;
+}
+
+// 把 donor 的全部 chunk 并入 arena，插在当前 chunk 之后，arena 继续在原 chunk 上分配
+static void arena_adopt(struct arena *arena, struct arena *donor) {
+    struct arena_chunk *first = donor->chunks;
+    if (!first) {
+        return;
+    }
+    donor->chunks = NULL;
+    if (!arena->chunks) {
+        arena->chunks = first;
+        return;
+    }
+    struct arena_chunk *last = first;
+    while (last->next) {
+        last = last->next;
+    }
+    last->next = arena->chunks->next;
+    arena->chunks->next = first;
+}
+
+#define UNRESOLVED_LIBRARY_ORDINAL UINT32_MAX
+#define CXX_NAME_PREFIX "c++:"
+
+enum rebinding_name_kind {
+    REBINDING_NAME_SYMBOL,          // 按符号名（去掉前导 '_'）匹配
+    REBINDING_NAME_CXX_SIGNATURE,   // 按 demangle 后的完整签名匹配
+    REBINDING_NAME_CXX_PREFIX,      // 按 demangle 后的前缀匹配，如 "c++:mylib::*"
+};
+
+// rebinding 名称拆分后的信息，形如 "close@libSystem.B.dylib"
+struct rebinding_name {
+    enum rebinding_name_kind kind;
+    const char *symbol;             // 去掉 "c++:" 前缀后的符号名
+    size_t symbol_len;              // '@'（以及前缀匹配的 '*'）之前的符号名长度
+    const char *library;            // '@' 之后的库名限定，未限定时为 NULL
+    uint32_t library_ordinal;       // library 在当前镜像中的库序号，每个镜像解析一次
+};
+
 struct rebindings_entry {
     struct rebinding *rebindings;   // rebinding 数组实例
+    struct rebinding_name *names;   // 与 rebindings 一一对应
     size_t rebindings_nel;          // 元素数量
     struct rebindings_entry *next;  // 链表索引
 };
 
 // 全局量，直接拿出表头
 static struct rebindings_entry *_rebindings_head;
+// 全局链表的节点从不释放，统一从这里分配
+static struct arena _rebindings_arena;
+// 每次修改全局链表时递增，用于判断缓存的 plan 是否过期
+static uint64_t _rebindings_generation;
+
+/*
+ * Serializes rebind_symbols against dyld add-image callbacks, which may arrive
+ * on any thread. dyld runs those callbacks with its own lock held, so no dyld
+ * function is ever called while this one is held. It is recursive because a
+ * replacement may itself end up calling into fishhook.
+ */
+static pthread_mutex_t _rebindings_lock;
+static pthread_once_t _rebindings_lock_once = PTHREAD_ONCE_INIT;
+static unsigned int _rebindings_lock_depth;                     // 持有锁的线程的递归层数
+static bool _rebindings_torn;                                   // fork 时其他线程正持有锁，子进程中的状态不可信
+
+static void init_rebindings_lock(void) {
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&_rebindings_lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+struct stats_counters {
+    _Atomic uint64_t images_scanned;
+    _Atomic uint64_t slots_scanned;
+    _Atomic uint64_t slots_rebound;
+    _Atomic uint64_t scan_ns;
+    _Atomic uint64_t mprotect_calls;
+    _Atomic uint64_t pages_unprotected;
+};
+
+#define STATS_SEGMENT_MAGIC 0x66687332  // 'fhs2'，计数布局变化时更换
+
+// 共享内存段中每个进程占一个槽位，pid 为 0 表示空闲
+struct stats_slot {
+    _Atomic int32_t pid;
+    struct stats_counters counters;
+};
+
+struct stats_segment {
+    _Atomic uint32_t magic;         // 创建者初始化完成后才写入
+    uint32_t slot_count;
+    struct stats_slot slots[];
+};
+
+static struct stats_counters _local_counters;
+static struct stats_counters *_counters = &_local_counters;    // 挂到共享内存后指向本进程槽位
+static struct stats_segment *_stats_segment;
+
+static void stats_add(_Atomic uint64_t *counter, uint64_t value) {
+    if (value) {
+        atomic_fetch_add_explicit(counter, value, memory_order_relaxed);
+    }
+}
+
+static uint64_t stats_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void stats_load(const struct stats_counters *counters, struct fishhook_stats *stats) {
+    stats->images_scanned += atomic_load_explicit(&counters->images_scanned, memory_order_relaxed);
+    stats->slots_scanned += atomic_load_explicit(&counters->slots_scanned, memory_order_relaxed);
+    stats->slots_rebound += atomic_load_explicit(&counters->slots_rebound, memory_order_relaxed);
+    stats->scan_ns += atomic_load_explicit(&counters->scan_ns, memory_order_relaxed);
+    stats->mprotect_calls += atomic_load_explicit(&counters->mprotect_calls, memory_order_relaxed);
+    stats->pages_unprotected += atomic_load_explicit(&counters->pages_unprotected, memory_order_relaxed);
+}
+
+// 抢占一个空闲槽位，或回收已退出进程留下的槽位
+static struct stats_slot *claim_stats_slot(struct stats_segment *segment) {
+    int32_t self = (int32_t)getpid();
+    for (uint32_t i = 0; i < segment->slot_count; i++) {
+        struct stats_slot *slot = &segment->slots[i];
+        int32_t owner = atomic_load_explicit(&slot->pid, memory_order_relaxed);
+        if (owner != 0 && (kill(owner, 0) == 0 || errno != ESRCH)) {
+            continue;
+        }
+        if (atomic_compare_exchange_strong(&slot->pid, &owner, self)) {
+            atomic_store_explicit(&slot->counters.images_scanned, 0, memory_order_relaxed);
+            atomic_store_explicit(&slot->counters.slots_scanned, 0, memory_order_relaxed);
+            atomic_store_explicit(&slot->counters.slots_rebound, 0, memory_order_relaxed);
+            atomic_store_explicit(&slot->counters.scan_ns, 0, memory_order_relaxed);
+            atomic_store_explicit(&slot->counters.mprotect_calls, 0, memory_order_relaxed);
+            atomic_store_explicit(&slot->counters.pages_unprotected, 0, memory_order_relaxed);
+            return slot;
+        }
+    }
+    return NULL;
+}
+
+// mapped_size 返回实际映射的大小，munmap 时必须用它：打开已有段时按文件大小映射
+static struct stats_segment *map_stats_segment(const char *name, uint32_t slot_count, bool create, size_t *mapped_size) {
+    size_t size = sizeof(struct stats_segment) + sizeof(struct stats_slot) * slot_count;
+    bool created = false;
+    int fd = -1;
+    if (create) {
+        fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+        created = fd >= 0;
+    }
+    if (fd < 0) {
+        fd = shm_open(name, O_RDWR, 0);
+        if (fd < 0) {
+            return NULL;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(struct stats_segment)) {
+            close(fd);                                              // 创建者尚未完成 ftruncate
+            return NULL;
+        }
+        size = (size_t)st.st_size;
+    } else if (ftruncate(fd, (off_t)size) != 0) {
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+    struct stats_segment *segment = (struct stats_segment *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (segment == MAP_FAILED) {
+        return NULL;
+    }
+    if (created) {
+        segment->slot_count = slot_count;
+        atomic_store_explicit(&segment->magic, STATS_SEGMENT_MAGIC, memory_order_release);
+    } else if (atomic_load_explicit(&segment->magic, memory_order_acquire) != STATS_SEGMENT_MAGIC ||
+               sizeof(struct stats_segment) + sizeof(struct stats_slot) * segment->slot_count > size) {
+        munmap(segment, size);
+        return NULL;
+    }
+    *mapped_size = size;
+    return segment;
+}
+
+/*
+ * The child inherits the patched slots and the registry as-is, so nothing is
+ * rescanned; only the lock, owned by a thread that no longer exists, is reset.
+ * There is no prepare handler: fork takes dyld's lock after the pthread_atfork
+ * handlers have run, and a thread inside dlopen may hold that lock while it
+ * waits for ours in the add-image callback. If some thread was inside the lock
+ * when fork was called, the registry and caches may be half updated, so every
+ * later call in the child fails instead of reading them.
+ */
+static void rebindings_atfork_child(void) {
+    _rebindings_torn = _rebindings_lock_depth != 0;
+    init_rebindings_lock();
+    _rebindings_lock_depth = 0;
+    if (_stats_segment) {
+        // 子进程不能继续写父进程的槽位，申请不到时退回进程内计数
+        struct stats_slot *slot = claim_stats_slot(_stats_segment);
+        _counters = slot ? &slot->counters : &_local_counters;
+    }
+}
+
+static void setup_rebindings_lock(void) {
+    init_rebindings_lock();
+    pthread_atfork(NULL, NULL, rebindings_atfork_child);
+}
+
+void fishhook_get_stats(struct fishhook_stats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    stats_load(_counters, stats);
+}
+
+int fishhook_stats_attach_shared(const char *name, uint32_t max_processes) {
+    // fork 的子进程要换用自己的槽位，atfork 处理函数与锁一起注册，可能还没有调用过 rebind_symbols
+    pthread_once(&_rebindings_lock_once, setup_rebindings_lock);
+    if (_stats_segment) {
+        return -1;
+    }
+    size_t size;
+    struct stats_segment *segment = map_stats_segment(name, max_processes, true, &size);
+    if (!segment) {
+        return -1;
+    }
+    struct stats_slot *slot = claim_stats_slot(segment);
+    if (!slot) {
+        munmap(segment, size);
+        return -1;
+    }
+    // 把挂载前已经累计的计数带到共享槽位中
+    struct fishhook_stats local = {0};
+    stats_load(&_local_counters, &local);
+    stats_add(&slot->counters.images_scanned, local.images_scanned);
+    stats_add(&slot->counters.slots_scanned, local.slots_scanned);
+    stats_add(&slot->counters.slots_rebound, local.slots_rebound);
+    stats_add(&slot->counters.scan_ns, local.scan_ns);
+    stats_add(&slot->counters.mprotect_calls, local.mprotect_calls);
+    stats_add(&slot->counters.pages_unprotected, local.pages_unprotected);
+    _stats_segment = segment;
+    _counters = &slot->counters;
+    return 0;
+}
+
+int fishhook_stats_read_shared(const char *name, struct fishhook_stats *total) {
+    size_t size;
+    struct stats_segment *segment = map_stats_segment(name, 0, false, &size);
+    if (!segment) {
+        return -1;
+    }
+    int processes = 0;
+    memset(total, 0, sizeof(*total));
+    for (uint32_t i = 0; i < segment->slot_count; i++) {
+        if (atomic_load_explicit(&segment->slots[i].pid, memory_order_relaxed) != 0) {
+            stats_load(&segment->slots[i].counters, total);
+            processes++;
+        }
+    }
+    munmap(segment, size);
+    return processes;
+}
+
+/*
+ * A lazy symbol pointer that has never been called still points at the
+ * importing image's own __stub_helper. Capturing that into replaced would send
+ * the first call through the original into dyld's lazy binder, so such
+ * originals are queued and looked up with dlsym once the outermost
+ * unlock_rebindings has dropped the lock. dlopen and dlsym take dyld's lock,
+ * and a thread inside dlopen may be waiting for ours from an add-image
+ * callback, so they are never called while it is held.
+ */
+struct unresolved_original {
+    struct unresolved_original *next;
+    void **replaced;
+    void *stub;                     // 写入 replaced 的 __stub_helper 地址，解析期间被改写过就不再覆盖
+    const char *symbol_name;        // 已复制，不带前导 '_'
+    const char *library_name;       // 已复制；特殊库序号为 NULL，按全局查找
+    void *resolved;
+};
+
+// 持有锁时追加，由最外层的 unlock_rebindings 整体取走
+static struct unresolved_original *_unresolved_originals;
+static struct arena _unresolved_originals_arena;
+
+static void resolve_unresolved_originals(struct unresolved_original *pending) {
+    const char *library_name = NULL;
+    void *handle = NULL;
+    for (struct unresolved_original *entry = pending; entry; entry = entry->next) {
+        if (entry->library_name != library_name) {                  // 同一镜像同一个库的条目共用一份名字拷贝
+            if (handle) {
+                dlclose(handle);
+            }
+            library_name = entry->library_name;
+            handle = library_name ? dlopen(library_name, RTLD_LAZY | RTLD_NOLOAD) : NULL;
+        }
+        if (!library_name) {
+            entry->resolved = dlsym(RTLD_DEFAULT, entry->symbol_name);
+        } else if (handle) {
+            entry->resolved = dlsym(handle, entry->symbol_name);
+        }                                                           // 弱链接且未加载的库保留 stub
+    }
+    if (handle) {
+        dlclose(handle);
+    }
+    pthread_mutex_lock(&_rebindings_lock);
+    for (struct unresolved_original *entry = pending; entry; entry = entry->next) {
+        if (entry->resolved && *entry->replaced == entry->stub) {
+            *entry->replaced = entry->resolved;
+        }
+    }
+    pthread_mutex_unlock(&_rebindings_lock);
+}
+
+// 返回 false 时锁同样已经持有，调用方放弃操作后照常解锁
+static bool lock_rebindings(void) {
+    pthread_once(&_rebindings_lock_once, setup_rebindings_lock);
+    pthread_mutex_lock(&_rebindings_lock);
+    _rebindings_lock_depth++;
+    return !_rebindings_torn;
+}
+
+static void unlock_rebindings(void) {
+    struct unresolved_original *pending = NULL;
+    struct arena arena = {0};
+    if (--_rebindings_lock_depth == 0 && _unresolved_originals) {
+        pending = _unresolved_originals;
+        arena = _unresolved_originals_arena;
+        _unresolved_originals = NULL;
+        _unresolved_originals_arena = (struct arena){0};
+    }
+    pthread_mutex_unlock(&_rebindings_lock);
+    if (pending) {
+        resolve_unresolved_originals(pending);
+        arena_release(&arena);
+    }
+}
 
 /**
  * 将 rebinding 的多个实例组织成一个链表
  *
  * prepend_rebindings
  * struct rebindings_entry **rebindings_head
+ * struct arena *arena
  * struct rebinding rebindings[]
  * size_t nel
  */
 static int prepend_rebindings(struct rebindings_entry **rebindings_head,
+                              struct arena *arena,
                               struct rebinding rebindings[],
                               size_t nel) {
-    struct rebindings_entry *new_entry = (struct rebindings_entry *) malloc(sizeof(struct rebindings_entry));
+    struct rebindings_entry *new_entry = (struct rebindings_entry *) arena_alloc(arena, sizeof(struct rebindings_entry));
     if (!new_entry) {
         return -1;
     }
-    new_entry->rebindings = (struct rebinding *) malloc(sizeof(struct rebinding) * nel);
-    if (!new_entry->rebindings) {
-        free(new_entry);
-        return -1;
+    new_entry->rebindings = (struct rebinding *) arena_alloc(arena, sizeof(struct rebinding) * nel);
+    new_entry->names = (struct rebinding_name *) arena_alloc(arena, sizeof(struct rebinding_name) * nel);
+    if (!new_entry->rebindings || !new_entry->names) {
+        return -1;                                                  // 已分配的部分留在 arena 中，随 arena 一起回收
     }
     memcpy(new_entry->rebindings, rebindings, sizeof(struct rebinding) * nel);
+    for (size_t i = 0; i < nel; i++) {
+        struct rebinding_name *parsed = &new_entry->names[i];
+        const char *name = rebindings[i].name;
+        parsed->kind = REBINDING_NAME_SYMBOL;
+        if (strncmp(name, CXX_NAME_PREFIX, strlen(CXX_NAME_PREFIX)) == 0) {
+            name += strlen(CXX_NAME_PREFIX);
+            parsed->kind = REBINDING_NAME_CXX_SIGNATURE;
+        }
+        const char *at = strchr(name, '@');
+        parsed->symbol = name;
+        parsed->symbol_len = at ? (size_t)(at - name) : strlen(name);
+        parsed->library = at ? at + 1 : NULL;
+        parsed->library_ordinal = UNRESOLVED_LIBRARY_ORDINAL;
+        if (parsed->kind == REBINDING_NAME_CXX_SIGNATURE &&
+            parsed->symbol_len > 0 && name[parsed->symbol_len - 1] == '*') {
+            parsed->kind = REBINDING_NAME_CXX_PREFIX;
+            parsed->symbol_len--;
+        }
+    }
     new_entry->rebindings_nel = nel;
     new_entry->next = *rebindings_head; // 为 new_entry->next 赋值，维护链表结构
     *rebindings_head = new_entry;       // 移动 head 指针，指向表头
@@ -111,170 +532,1985 @@ static vm_prot_t get_protection(void *sectionStart) {
         return VM_PROT_READ;            // 只读权限
     }
 }
-static void perform_rebinding_with_section(struct rebindings_entry *rebindings,
-                                           section_t *section,          // _DATA.__nl_symbol_ptr（_DATA.__la_symbol_ptr）
-                                           intptr_t slide,              // ASLR
-                                           nlist_t *symtab,             // 符号表
-                                           char *strtab,                // 字符表
-                                           uint32_t *indirect_symtab)   // 间接符号表（每个条目的内容为其在 Symbol Table 中的序号）
-{
-    const bool isDataConst = strcmp(section->segname, SEG_DATA_CONST) == 0;         // section 是否可写
-    
-    uint32_t *indirect_symbol_indices = indirect_symtab + section->reserved1;       // section->reserved1 为 Section 在间接符号表中的起始条目
-    void **indirect_symbol_bindings = (void **)((uintptr_t)slide + section->addr);  // 存放绑定的各个符号（section 对应的符号存在这）
-    
-    vm_prot_t oldProtection = VM_PROT_READ;
-    if (isDataConst) {
-        oldProtection = get_protection(rebindings);
-        mprotect(indirect_symbol_bindings, section->size, PROT_READ | PROT_WRITE);  // 修改 indirect_symbol_bindings 为可读写权限
+// 库名限定既可以是完整的 install name，也可以只是最后一个路径分量
+static bool library_matches(const char *install_name, const char *library) {
+    if (strcmp(install_name, library) == 0) {
+        return true;
     }
-    // 用（size / 一阶指针）来计算个数，遍历整个 Section
-    for (uint i = 0; i < section->size / sizeof(void *); i++) {
-        uint32_t symtab_index = indirect_symbol_indices[i];                 // 获取第 i 个地址在符号表中的序号（即，Section 的第 i 个地址对应的符号表序号）
-        if (symtab_index == INDIRECT_SYMBOL_ABS ||
-            symtab_index == INDIRECT_SYMBOL_LOCAL ||
-            symtab_index == (INDIRECT_SYMBOL_LOCAL | INDIRECT_SYMBOL_ABS)) {
-            continue;
-        }
-        uint32_t strtab_offset = symtab[symtab_index].n_un.n_strx;          // 在符号表中获取符号名在字符表中的偏移
-        char *symbol_name = strtab + strtab_offset;                         // 获取字符表中的符号名
-        bool symbol_name_longer_than_1 = symbol_name[0] && symbol_name[1];
-        
-        // 遍历 rebindings，依次匹配符号名
-        struct rebindings_entry *cur = rebindings;
-        while (cur) {
-            for (uint j = 0; j < cur->rebindings_nel; j++) {
-                if (symbol_name_longer_than_1 && strcmp(&symbol_name[1], cur->rebindings[j].name) == 0) {
-                    // 如果是第一次对跳转地址进行重写
-                    if (cur->rebindings[j].replaced != NULL && indirect_symbol_bindings[i] != cur->rebindings[j].replacement) {
-                        *(cur->rebindings[j].replaced) = indirect_symbol_bindings[i];   // 记录原始跳转地址
-                    }
-                    indirect_symbol_bindings[i] = cur->rebindings[j].replacement;       // 重写跳转地址
-                    goto symbol_loop;                                                   // 迭代到下一个
-                }
+    const char *base = strrchr(install_name, '/');
+    return base && strcmp(base + 1, library) == 0;
+}
+
+/*
+ * A flattened view of a rebindings list, built once and shared by every image
+ * scanned until the list changes, so the burst of add-image callbacks caused by
+ * a single dlopen does not re-walk the list. Plain symbol names are interned
+ * into a hash table: a slot costs one hash and a short chain walk instead of a
+ * strcmp against every rebinding.
+ */
+struct plan_entry {
+    struct rebinding *rebinding;
+    struct rebinding_name *name;
+    size_t precedence;                  // 链表遍历顺序，越小优先级越高
+    uint32_t hash;
+    struct plan_entry *next_in_bucket;  // 同一个桶内按优先级排列
+};
+
+struct rebinding_plan {
+    struct arena arena;
+    bool valid;
+    uint64_t generation;
+    struct plan_entry *entries;         // 按优先级排列
+    size_t entries_nel;
+    struct plan_entry **buckets;        // 普通符号名的哈希表，没有普通符号时为 NULL
+    uint32_t bucket_mask;
+    size_t qualified_count;             // 带库名限定的 rebinding 数量
+    size_t cxx_count;                   // "c++:" rebinding 数量
+};
+
+static struct rebinding_plan _rebindings_plan;
+
+// FNV-1a
+static uint32_t hash_symbol(const char *symbol, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ (uint8_t)symbol[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// 与 hash_symbol 相同，但一边计算一边求出以 '\0' 结尾的符号名长度
+static uint32_t hash_symbol_name(const char *symbol, size_t *len) {
+    uint32_t hash = 2166136261u;
+    const char *p = symbol;
+    for (; *p; p++) {
+        hash = (hash ^ (uint8_t)*p) * 16777619u;
+    }
+    *len = (size_t)(p - symbol);
+    return hash;
+}
+
+static bool build_rebinding_plan(struct rebinding_plan *plan,
+                                 struct rebindings_entry *rebindings) {
+    memset(plan, 0, sizeof(*plan));
+    size_t count = 0;
+    for (struct rebindings_entry *cur = rebindings; cur; cur = cur->next) {
+        count += cur->rebindings_nel;
+    }
+    plan->entries = (struct plan_entry *) arena_alloc(&plan->arena, sizeof(struct plan_entry) * count);
+    if (!plan->entries) {
+        return false;
+    }
+    size_t symbol_count = 0;
+    for (struct rebindings_entry *cur = rebindings; cur; cur = cur->next) {
+        for (size_t j = 0; j < cur->rebindings_nel; j++) {
+            struct plan_entry *entry = &plan->entries[plan->entries_nel];
+            entry->rebinding = &cur->rebindings[j];
+            entry->name = &cur->names[j];
+            entry->precedence = plan->entries_nel++;
+            if (entry->name->library) {
+                plan->qualified_count++;
+            }
+            if (entry->name->kind == REBINDING_NAME_SYMBOL) {
+                entry->hash = hash_symbol(entry->name->symbol, entry->name->symbol_len);
+                symbol_count++;
+            } else {
+                plan->cxx_count++;
             }
-            cur = cur->next;
         }
-    symbol_loop:;
     }
-    if (isDataConst) {
-        int protection = 0;
-        if (oldProtection & VM_PROT_READ) {
-            protection |= PROT_READ;
+    if (symbol_count) {
+        uint32_t bucket_count = 1;
+        while (bucket_count < symbol_count * 2) {
+            bucket_count <<= 1;
         }
-        if (oldProtection & VM_PROT_WRITE) {
-            protection |= PROT_WRITE;
+        plan->buckets = (struct plan_entry **) arena_alloc(&plan->arena, sizeof(struct plan_entry *) * bucket_count);
+        if (!plan->buckets) {
+            arena_release(&plan->arena);
+            return false;
         }
-        if (oldProtection & VM_PROT_EXECUTE) {
-            protection |= PROT_EXEC;
+        plan->bucket_mask = bucket_count - 1;
+        // 逆序头插，使桶内链表保持优先级顺序
+        for (size_t i = plan->entries_nel; i-- > 0;) {
+            struct plan_entry *entry = &plan->entries[i];
+            if (entry->name->kind == REBINDING_NAME_SYMBOL) {
+                struct plan_entry **bucket = &plan->buckets[entry->hash & plan->bucket_mask];
+                entry->next_in_bucket = *bucket;
+                *bucket = entry;
+            }
         }
-        mprotect(indirect_symbol_bindings, section->size, protection);  // 重置权限
     }
+    plan->valid = true;
+    return true;
 }
 
-static void rebind_symbols_for_image(struct rebindings_entry *rebindings,
-                                     const struct mach_header *header,
-                                     intptr_t slide) {
-    Dl_info info;
-    if (dladdr(header, &info) == 0) {
+// 返回全局链表对应的 plan，链表变化后才重新构建；调用方需持有锁
+static const struct rebinding_plan *current_rebinding_plan(void) {
+    if (!_rebindings_plan.valid || _rebindings_plan.generation != _rebindings_generation) {
+        arena_release(&_rebindings_plan.arena);
+        if (!build_rebinding_plan(&_rebindings_plan, _rebindings_head)) {
+            return NULL;
+        }
+        _rebindings_plan.generation = _rebindings_generation;
+    }
+    return &_rebindings_plan;
+}
+
+/*
+ * Resolves the library qualifier of every rebinding to the two-level namespace
+ * ordinal it has in this image, so that matching a slot only needs to compare
+ * GET_LIBRARY_ORDINAL(n_desc) against a precomputed integer.
+ */
+static void resolve_library_ordinals(const struct rebinding_plan *plan,
+                                     const char **dylib_names,
+                                     uint32_t dylib_count) {
+    if (!plan->qualified_count) {
         return;
     }
-    segment_command_t *cur_seg_cmd;
-    segment_command_t *linkedit_segment = NULL;
-    struct symtab_command* symtab_cmd = NULL;
-    struct dysymtab_command* dysymtab_cmd = NULL;
-    uintptr_t cur = (uintptr_t)header + sizeof(mach_header_t);      // 跳过 Mach-O Header
-    // 遍历每一个 Load Command，得到 SEG_LINKEDIT、LC_SYMTAB、LC_DYSYMTAB
-    for (uint i = 0; i < header->ncmds; i++, cur += cur_seg_cmd->cmdsize) {
-        cur_seg_cmd = (segment_command_t *)cur;                     // 取出当前的 Load Command
-        if (cur_seg_cmd->cmd == LC_SEGMENT_ARCH_DEPENDENT) {
-            if (strcmp(cur_seg_cmd->segname, SEG_LINKEDIT) == 0) {  // SEG_LINKEDIT：加载命令信息
-                linkedit_segment = cur_seg_cmd;
+    for (size_t i = 0; i < plan->entries_nel; i++) {
+        struct rebinding_name *name = plan->entries[i].name;
+        if (!name->library) {
+            continue;
+        }
+        name->library_ordinal = UNRESOLVED_LIBRARY_ORDINAL;
+        for (uint32_t k = 0; k < dylib_count; k++) {
+            if (library_matches(dylib_names[k], name->library)) {
+                name->library_ordinal = k + 1;  // 库序号从 1 开始
+                break;
             }
-        } else if (cur_seg_cmd->cmd == LC_SYMTAB) {                 // LC_SYMTAB：链接器信息
-            symtab_cmd = (struct symtab_command*)cur_seg_cmd;
-        } else if (cur_seg_cmd->cmd == LC_DYSYMTAB) {               // LC_DYSYMTAB：动态链接器信息
-            dysymtab_cmd = (struct dysymtab_command*)cur_seg_cmd;
         }
     }
-    
-    if (!symtab_cmd || !dysymtab_cmd || !linkedit_segment ||
-        !dysymtab_cmd->nindirectsyms) {
+}
+
+/*
+ * Demangled names of an image's undefined symbols, matched against the C++
+ * rebindings once per image. matches[i] is the plan entry that owns symbol
+ * (first + i), or NULL, so the slot loop never demangles anything.
+ */
+typedef char *(*cxa_demangle_t)(const char *, char *, size_t *, int *);
+
+// 通过 dlsym 取 __cxa_demangle，纯 C 工程不必链接 libc++abi
+static cxa_demangle_t get_cxa_demangle(void) {
+    static cxa_demangle_t demangle = NULL;
+    static bool looked_up = false;
+    if (!looked_up) {
+        demangle = (cxa_demangle_t)dlsym(RTLD_DEFAULT, "__cxa_demangle");
+        looked_up = true;
+    }
+    return demangle;
+}
+
+static bool cxx_name_matches(const struct rebinding_name *name, const char *demangled) {
+    if (strncmp(demangled, name->symbol, name->symbol_len) != 0) {
+        return false;
+    }
+    return name->kind == REBINDING_NAME_CXX_PREFIX || demangled[name->symbol_len] == '\0';
+}
+
+// __cxa_demangle 自己使用 malloc，只有注册了 "c++:" rebinding 时才会用到
+struct demangler {
+    cxa_demangle_t demangle;
+    char *buffer;                   // 可能被 realloc，复用到下一个符号
+    size_t buffer_len;
+};
+
+// 对 Itanium ABI 的 C++ 符号（带前导 '_'）demangle，结果复制到 arena 中；其他符号返回 NULL
+static const char *demangle_symbol(struct demangler *demangler,
+                                   struct arena *arena,
+                                   const char *symbol_name) {
+    if (strncmp(symbol_name, "__Z", 3) != 0) {
+        return NULL;
+    }
+    int status = 0;
+    char *demangled = demangler->demangle(&symbol_name[1], demangler->buffer, &demangler->buffer_len, &status);
+    if (status != 0 || !demangled) {
+        return NULL;
+    }
+    demangler->buffer = demangled;
+    size_t len = strlen(demangled);
+    char *copy = (char *) arena_alloc(arena, len + 1);
+    if (!copy) {
+        return NULL;
+    }
+    memcpy(copy, demangled, len + 1);
+    return copy;
+}
+
+// demangled 为镜像缓存的 demangle 结果，返回优先级最高的 "c++:" rebinding
+static const struct plan_entry *lookup_cxx_symbol(const struct rebinding_plan *plan,
+                                                  const char *demangled,
+                                                  uint32_t library_ordinal) {
+    if (!demangled || !plan->cxx_count) {
+        return NULL;
+    }
+    for (size_t j = 0; j < plan->entries_nel; j++) {
+        const struct rebinding_name *name = plan->entries[j].name;
+        if (name->kind == REBINDING_NAME_SYMBOL ||
+            (name->library && name->library_ordinal != library_ordinal)) {
+            continue;
+        }
+        if (cxx_name_matches(name, demangled)) {
+            return &plan->entries[j];                               // entries 按优先级排列，第一个即可
+        }
+    }
+    return NULL;
+}
+
+/*
+ * A lazy or non-lazy symbol pointer section whose indirect symbol indices have
+ * all been checked against the symbol and string tables.
+ */
+struct symbol_pointer_section {
+    void **bindings;                // 存放绑定的各个符号（已加上 slide）
+    const uint32_t *indices;        // 间接符号表中对应的条目（每个条目的内容为其在 Symbol Table 中的序号）
+    size_t count;
+    uint32_t segment;               // 所在段在 image_view.segments 中的下标
+    bool lazy;                      // S_LAZY_SYMBOL_POINTERS，未调用过的 slot 指向 __stub_helper
+    bool is_auth;                   // __auth_got / __auth_ptr，指针带有 arm64e 签名
+};
+
+/*
+ * The segments of an image, in LC_SEGMENT order. Bind opcodes refer to
+ * segments by this index as well.
+ */
+// 段内偏移
+struct auth_range {
+    uint64_t offset;
+    uint64_t size;
+};
+
+struct image_segment {
+    uintptr_t start;                // 已加上 slide
+    uint64_t size;
+    bool may_be_read_only;          // 绑定完成后可能被改为只读，写入前需要检查权限
+    const struct auth_range *auth_ranges;   // 段内的 __auth_got / __auth_ptr，绑定操作码得到的指针据此判断是否签名
+    uint32_t auth_ranges_nel;
+    bool is_writable;               // 初始权限可写，其他 hook 库保存的原始地址就在这类段中
+    uint64_t file_size;             // 之后直到 size 都是零填充（__bss、__common），只有写过的页需要查看
+};
+
+/*
+ * Images without an indirect symbol table (no LC_DYSYMTAB, or nindirectsyms
+ * == 0) only describe their imports through the LC_DYLD_INFO bind and lazy
+ * bind opcode streams. Those are decoded once per image, in a single linear
+ * pass, into a table mapping each bound pointer to its symbol name.
+ */
+struct bound_pointer {
+    void **slot;
+    const char *symbol_name;        // 操作码流中的符号名（带前导 '_'）
+    uint32_t library_ordinal;       // 特殊序号（self、main executable、flat/weak lookup）记为 0
+    uint32_t segment;               // image_view.segments 中的下标
+    const char *demangled;          // demangle_image_symbols 生成，非 C++ 符号为 NULL
+    bool lazy;                      // 来自懒绑定流
+    bool is_auth;                   // 位于 __auth_got / __auth_ptr 中
+};
+
+#define BOUND_POINTER_BLOCK_SIZE 256
+
+// 解码时不知道条目总数，按块追加，避免在 arena 中扩容
+struct bound_pointer_block {
+    struct bound_pointer_block *next;
+    size_t count;
+    struct bound_pointer entries[BOUND_POINTER_BLOCK_SIZE];
+};
+
+/*
+ * Everything rebind_symbols_for_image needs from an image, produced by a single
+ * bounds-checking pass over its load commands and tables. Every index reachable
+ * from a view has been validated, so the slot loop runs without checks. Only
+ * the header's sizeofcmds and the segments' mapped ranges are taken as given,
+ * since dyld has already mapped the image from them. Views are cached per
+ * header until dyld removes the image.
+ */
+struct image_view {
+    const struct mach_header *header;
+    intptr_t slide;
+    nlist_t *symtab;                // 符号表
+    uint32_t nsyms;
+    char *strtab;                   // 字符表，保证以 '\0' 结尾
+    uint32_t strsize;
+    uint32_t iundefsym;             // 导入符号在符号表中的范围
+    uint32_t nundefsym;
+    const char **dylib_names;       // 按库序号排列的 install name
+    uint32_t dylib_count;
+    struct image_segment *segments;
+    uint32_t segments_nel;
+    uintptr_t stub_helper_start;    // __TEXT,__stub_helper 的范围（已加上 slide），没有时为 0
+    uint64_t stub_helper_size;
+    struct symbol_pointer_section *sections;
+    size_t sections_nel;
+    struct bound_pointer_block *binds;          // 没有间接符号表时，由绑定操作码解码得到
+    const char **demangled;         // 导入符号 demangle 后的名称，下标从 iundefsym 起；第一次需要时生成
+                                    // 绑定操作码得到的指针表则存在各 bound_pointer 中
+    bool demangle_attempted;
+    bool rejected;                  // 校验失败的镜像只留下这个标记，避免每次重放都重新校验
+    struct image_view *next;
+};
+
+/*
+ * Demangles the imported symbols of an image the first time a "c++:" rebinding
+ * needs them. The names are kept with the cached view until dyld removes the
+ * image, so later rebind_symbols calls only compare strings against the plan.
+ */
+static void demangle_image_symbols(struct image_view *view, struct arena *arena) {
+    if (view->demangle_attempted) {
         return;
     }
-    
-    /*
-        slide: ASLR 偏移量
-        vmaddr: SEG_LINKEDIT 的虚拟地址
-        fileoff: SEG_LINKEDIT 地址偏移
-        虚拟地址偏移量 = 虚拟地址（vmaddr） - 地址移量（fileoff）
-        段基址 = ASLR的偏移量（slide） + 虚拟地址偏移量
-     */
-    
-    // Find base symbol/string table addresses
-    uintptr_t linkedit_base = (uintptr_t)slide + linkedit_segment->vmaddr - linkedit_segment->fileoff;
-    // 计算 symbol table 表的首地址
-    nlist_t *symtab = (nlist_t *)(linkedit_base + symtab_cmd->symoff);
-    // 计算 string table 首地址
-    char *strtab = (char *)(linkedit_base + symtab_cmd->stroff);
-    
-    // 计算 indirect symbol table 的首地址
-    // Get indirect symbol table (array of uint32_t indices into symbol table)
-    uint32_t *indirect_symtab = (uint32_t *)(linkedit_base + dysymtab_cmd->indirectsymoff);
-    
-    // 遍历 Load Commands 中的 Segment Command
-    cur = (uintptr_t)header + sizeof(mach_header_t);
-    for (uint i = 0; i < header->ncmds; i++, cur += cur_seg_cmd->cmdsize) {
-        cur_seg_cmd = (segment_command_t *)cur;                     // 取出当前的 Load Command
-        if (cur_seg_cmd->cmd == LC_SEGMENT_ARCH_DEPENDENT) {        // LC_SEGMENT_64
-            if (strcmp(cur_seg_cmd->segname, SEG_DATA) != 0 && strcmp(cur_seg_cmd->segname, SEG_DATA_CONST) != 0) {
-                continue;                                           // 过滤 __DATA 或者 __DATA_CONST
-            }
-            // 遍历 Segment command 中的 Section
-            for (uint j = 0; j < cur_seg_cmd->nsects; j++) {
-                section_t *sect = (section_t *)(cur + sizeof(segment_command_t)) + j;
-                uint32_t section_type = sect->flags & SECTION_TYPE; // 获取记录类型
-                // 如果为加载符号或非懒加载符号，进行重绑定
-                if (section_type == S_LAZY_SYMBOL_POINTERS || section_type == S_NON_LAZY_SYMBOL_POINTERS) {
-                    perform_rebinding_with_section(rebindings, sect, slide, symtab, strtab, indirect_symtab);
+    view->demangle_attempted = true;                                // 失败也不再重试
+    cxa_demangle_t demangle = get_cxa_demangle();
+    if (!demangle) {
+        return;
+    }
+    struct demangler demangler = { demangle, NULL, 0 };
+    if (view->binds) {
+        // 同一符号的连续绑定共用操作码流中的名字，只 demangle 一次
+        const char *previous_name = NULL;
+        const char *previous_demangled = NULL;
+        for (struct bound_pointer_block *block = view->binds; block; block = block->next) {
+            for (size_t i = 0; i < block->count; i++) {
+                struct bound_pointer *bound = &block->entries[i];
+                if (bound->symbol_name != previous_name) {
+                    previous_name = bound->symbol_name;
+                    previous_demangled = demangle_symbol(&demangler, arena, previous_name);
                 }
+                bound->demangled = previous_demangled;
             }
         }
+        free(demangler.buffer);
+        return;
     }
+    if (!view->nundefsym) {
+        return;
+    }
+    const char **demangled = (const char **) arena_alloc(arena, sizeof(const char *) * view->nundefsym);
+    if (!demangled) {
+        return;
+    }
+    for (uint32_t i = 0; i < view->nundefsym; i++) {
+        const char *symbol_name = view->strtab + view->symtab[view->iundefsym + i].n_un.n_strx;
+        demangled[i] = demangle_symbol(&demangler, arena, symbol_name);
+    }
+    free(demangler.buffer);
+    view->demangled = demangled;
 }
 
-static void _rebind_symbols_for_image(const struct mach_header *header,
-                                      intptr_t slide) {
-    rebind_symbols_for_image(_rebindings_head, header, slide);
+/*
+ * Pointers in __auth_got and __auth_ptr are signed with the IA key and their own
+ * address as discriminator. Outside of arm64e these are plain loads/stores.
+ */
+static void *read_symbol_pointer(bool is_auth, void **slot) {
+#if __has_feature(ptrauth_calls)
+    if (is_auth) {
+        void *stripped = ptrauth_strip(*slot, ptrauth_key_asia);
+        return ptrauth_sign_unauthenticated(stripped, ptrauth_key_function_pointer, 0);
+    }
+#else
+    (void)is_auth;
+#endif
+    return *slot;
 }
 
-int rebind_symbols_image(void *header,
-                         intptr_t slide,
-                         struct rebinding rebindings[],
-                         size_t rebindings_nel) {
-    struct rebindings_entry *rebindings_head = NULL;
-    int retval = prepend_rebindings(&rebindings_head, rebindings, rebindings_nel);
-    rebind_symbols_for_image(rebindings_head, (const struct mach_header *) header, slide);
-    if (rebindings_head) {
-        free(rebindings_head->rebindings);
+static void write_symbol_pointer(bool is_auth, void **slot, void *value) {
+#if __has_feature(ptrauth_calls)
+    if (is_auth) {
+        void *stripped = ptrauth_strip(value, ptrauth_key_function_pointer);
+        *slot = ptrauth_sign_unauthenticated(stripped, ptrauth_key_asia, slot);
+        return;
     }
-    free(rebindings_head);
-    return retval;
+#else
+    (void)is_auth;
+#endif
+    *slot = value;
 }
 
-int rebind_symbols(struct rebinding rebindings[], size_t rebindings_nel) {
-    int retval = prepend_rebindings(&_rebindings_head, rebindings, rebindings_nel);
-    if (retval < 0) {
-        return retval;
+// 将 slot 改写为 rebinding 的 replacement，首次改写时记录原始地址 original
+static void rebind_slot(const struct rebinding *rebinding, bool is_auth, void **slot, void *original) {
+    if (rebinding->replaced != NULL && original != rebinding->replacement) {
+        *(rebinding->replaced) = original;                          // 记录原始跳转地址
     }
-    if (!_rebindings_head->next) {          // NULL == _rebindings_head->next 代表第一次调用
-        // 第一次调用，注册 _rebind_symbols_for_image 回调，当 dyld 链接符号时，调用此回调函数
+    write_symbol_pointer(is_auth, slot, rebinding->replacement);    // 重写跳转地址
+}
+
+// 可能只读的内存在写入前改为可读写，返回是否修改了权限；old_protection 用于恢复
+static bool begin_writing(void *start, size_t size, vm_prot_t *old_protection) {
+    *old_protection = get_protection(start);
+    if (*old_protection & VM_PROT_WRITE) {
+        return false;                                               // 已经可写，不必修改权限
+    }
+    mprotect(start, size, PROT_READ | PROT_WRITE);
+    return true;
+}
+
+static void end_writing(void *start, size_t size, vm_prot_t old_protection) {
+    int protection = 0;
+    if (old_protection & VM_PROT_READ) {
+        protection |= PROT_READ;
+    }
+    if (old_protection & VM_PROT_WRITE) {
+        protection |= PROT_WRITE;
+    }
+    if (old_protection & VM_PROT_EXECUTE) {
+        protection |= PROT_EXEC;
+    }
+    mprotect(start, size, protection);                              // 重置权限
+}
+
+// 在 plan 的哈希表中查找符号名（去掉前导 '_'），桶内第一个满足库序号的即优先级最高
+static const struct plan_entry *lookup_symbol(const struct rebinding_plan *plan,
+                                              const char *symbol_name,
+                                              uint32_t library_ordinal) {
+    if (!plan->buckets || !symbol_name[0] || !symbol_name[1]) {
+        return NULL;
+    }
+    size_t symbol_len;
+    uint32_t hash = hash_symbol_name(&symbol_name[1], &symbol_len);
+    for (const struct plan_entry *entry = plan->buckets[hash & plan->bucket_mask]; entry; entry = entry->next_in_bucket) {
+        const struct rebinding_name *name = entry->name;
+        if (entry->hash == hash && name->symbol_len == symbol_len &&
+            memcmp(name->symbol, &symbol_name[1], symbol_len) == 0 &&
+            (!name->library || name->library_ordinal == library_ordinal)) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Matching and writing are split: slots are matched first and written
+ * afterwards, so that a read-only segment is made writable at most once per
+ * image, and only over the pages that actually hold a matched slot. Images with
+ * no match are never touched.
+ */
+struct pending_write {
+    void **slot;
+    const struct rebinding *rebinding;
+    uint32_t segment;               // image_view.segments 中的下标
+    const char *symbol_name;        // 带前导 '_'，用于解析尚未绑定的原始地址
+    uint32_t library_ordinal;
+    bool lazy;                      // 位于懒加载符号指针中
+    void *value;                    // rebinding 为 NULL 时原样写入的值
+    bool is_auth;                   // 带有 arm64e 签名
+};
+
+#define PENDING_WRITE_BLOCK_SIZE 256
+
+struct pending_write_block {
+    struct pending_write_block *next;
+    size_t count;
+    struct pending_write entries[PENDING_WRITE_BLOCK_SIZE];
+};
+
+struct pending_writes {
+    struct pending_write_block *head;
+    struct pending_write_block *tail;
+};
+
+static bool append_pending_write(struct arena *arena, struct pending_writes *writes, const struct pending_write *entry) {
+    if (!writes->tail || writes->tail->count == PENDING_WRITE_BLOCK_SIZE) {
+        struct pending_write_block *block = (struct pending_write_block *) arena_alloc(arena, sizeof(struct pending_write_block));
+        if (!block) {
+            return false;
+        }
+        if (writes->tail) {
+            writes->tail->next = block;
+        } else {
+            writes->head = block;
+        }
+        writes->tail = block;
+    }
+    writes->tail->entries[writes->tail->count++] = *entry;
+    return true;
+}
+
+static bool collect_section_writes(const struct rebinding_plan *plan,
+                                   const struct image_view *view,
+                                   const struct symbol_pointer_section *section,
+                                   struct arena *scratch,
+                                   struct pending_writes *writes)
+{
+    const uint32_t *indirect_symbol_indices = section->indices;
+    void **indirect_symbol_bindings = section->bindings;
+    nlist_t *symtab = view->symtab;                                         // 符号表
+    char *strtab = view->strtab;                                            // 字符表
+    
+    uint64_t slots_scanned = 0;
+    bool ok = true;
+    // 遍历整个 Section，索引已在 image_view 中校验过
+    for (size_t i = 0; i < section->count; i++) {
+        uint32_t symtab_index = indirect_symbol_indices[i];                 // 获取第 i 个地址在符号表中的序号（即，Section 的第 i 个地址对应的符号表序号）
+        if (symtab_index == INDIRECT_SYMBOL_ABS ||
+            symtab_index == INDIRECT_SYMBOL_LOCAL ||
+            symtab_index == (INDIRECT_SYMBOL_LOCAL | INDIRECT_SYMBOL_ABS)) {
+            continue;
+        }
+        slots_scanned++;
+        uint32_t strtab_offset = symtab[symtab_index].n_un.n_strx;          // 在符号表中获取符号名在字符表中的偏移
+        char *symbol_name = strtab + strtab_offset;                         // 获取字符表中的符号名
+        uint32_t library_ordinal = GET_LIBRARY_ORDINAL(symtab[symtab_index].n_desc);
+        const struct plan_entry *match = lookup_symbol(plan, symbol_name, library_ordinal);
+        // demangle 结果缓存在 image_view 中，按优先级与普通符号的匹配结果比较
+        if (view->demangled && symtab_index - view->iundefsym < view->nundefsym) {
+            const struct plan_entry *cxx_match = lookup_cxx_symbol(plan, view->demangled[symtab_index - view->iundefsym], library_ordinal);
+            if (cxx_match && (!match || cxx_match->precedence < match->precedence)) {
+                match = cxx_match;
+            }
+        }
+        if (!match) {
+            continue;
+        }
+        struct pending_write write = { &indirect_symbol_bindings[i], match->rebinding, section->segment, symbol_name, library_ordinal, section->lazy, NULL, section->is_auth };
+        if (!append_pending_write(scratch, writes, &write)) {
+            ok = false;
+            break;
+        }
+    }
+    stats_add(&_counters->slots_scanned, slots_scanned);
+    return ok;
+}
+
+// 解析在释放锁之后进行，这里只复制需要的名字；同一镜像同一个库的条目共用 library_names 中的拷贝
+struct original_queue {
+    const struct image_view *view;
+    struct arena *scratch;
+    const char **library_names;     // 按库序号缓存复制到队列 arena 中的 install name
+};
+
+static bool points_into_stub_helper(const struct image_view *view, void *pointer) {
+#if __has_feature(ptrauth_calls)
+    pointer = ptrauth_strip(pointer, ptrauth_key_function_pointer);
+#endif
+    return (uintptr_t)pointer - view->stub_helper_start < view->stub_helper_size;
+}
+
+static char *copy_original_name(const char *name) {
+    size_t length = strlen(name) + 1;
+    char *copy = (char *) arena_alloc(&_unresolved_originals_arena, length);
+    if (copy) {
+        memcpy(copy, name, length);
+    }
+    return copy;
+}
+
+// 分配失败时 replaced 保留 stub，与解析失败相同
+static void queue_original(struct original_queue *queue,
+                           void **replaced,
+                           void *stub,
+                           const char *symbol_name,
+                           uint32_t library_ordinal) {
+    if (symbol_name[0] != '_') {
+        return;
+    }
+    const struct image_view *view = queue->view;
+    const char *library_name = NULL;
+    if (library_ordinal >= 1 && library_ordinal <= view->dylib_count) {
+        if (!queue->library_names) {
+            queue->library_names = (const char **) arena_alloc(queue->scratch, sizeof(const char *) * view->dylib_count);
+            if (!queue->library_names) {
+                return;
+            }
+        }
+        uint32_t index = library_ordinal - 1;
+        if (!queue->library_names[index]) {
+            queue->library_names[index] = copy_original_name(view->dylib_names[index]);
+        }
+        library_name = queue->library_names[index];
+        if (!library_name) {
+            return;
+        }
+    }
+    struct unresolved_original *entry = (struct unresolved_original *) arena_alloc(&_unresolved_originals_arena, sizeof(struct unresolved_original));
+    const char *name = copy_original_name(&symbol_name[1]);
+    if (!entry || !name) {
+        return;
+    }
+    entry->replaced = replaced;
+    entry->stub = stub;
+    entry->symbol_name = name;
+    entry->library_name = library_name;
+    entry->next = _unresolved_originals;
+    _unresolved_originals = entry;
+}
+
+/*
+ * Every slot fishhook rewrites is recorded in a patch log keyed by slot
+ * address. A record is one layer: the value written and the value it replaced,
+ * with earlier layers for the same slot below it. The log is what allows a
+ * replacement to be swapped or detached after it was installed. Records are
+ * dropped together with their image's view when dyld removes the image.
+ */
+struct patch_record {
+    void **slot;
+    const struct image_view *view;
+    uint32_t segment;               // image_view.segments 中的下标
+    bool is_auth;                   // 带有 arm64e 签名
+    void *value;                    // 本层写入的值
+    void *previous;                 // 本层写入前 slot 中的值，未解析的 __stub_helper 原样保留，还原后由 dyld 重新绑定
+    void **replaced;                // 写入本层的 rebinding 的 replaced
+    struct patch_record *below;     // 同一 slot 更早的一层
+    void *checked_found;            // 上次检查过是否会转发回来的覆盖值，NULL 表示还没有检查过
+    bool found_may_forward;         // 对 checked_found 的结论
+};
+
+// 以下均需持有锁；索引中只存每个 slot 最上面的一层
+static struct arena _patches_arena;
+static struct patch_record *_free_patches;
+static struct patch_record **_patch_index;                      // 开放寻址，线性探测
+static size_t _patch_index_mask;
+static size_t _patch_count;
+static struct arena _patch_index_arena;
+
+static size_t patch_slot_hash(void **slot) {
+    uint64_t key = (uint64_t)(uintptr_t)slot >> 3;              // slot 按指针对齐，低位恒为 0
+    return (size_t)((key * 0x9e3779b97f4a7c15ull) >> 29);
+}
+
+// 返回 slot 所在的位置，不存在时返回可插入的空位
+static size_t find_patch_position(void **slot) {
+    size_t i = patch_slot_hash(slot) & _patch_index_mask;
+    while (_patch_index[i] && _patch_index[i]->slot != slot) {
+        i = (i + 1) & _patch_index_mask;
+    }
+    return i;
+}
+
+static struct patch_record *find_patch(void **slot) {
+    return _patch_index ? _patch_index[find_patch_position(slot)] : NULL;
+}
+
+// 保证还能再放入一个 slot，负载因子不超过 3/4
+static bool reserve_patch_index(void) {
+    size_t capacity = _patch_index ? _patch_index_mask + 1 : 0;
+    if ((_patch_count + 1) * 4 <= capacity * 3) {
+        return true;
+    }
+    size_t new_capacity = capacity ? capacity * 2 : 64;
+    struct arena arena = {0};
+    struct patch_record **index = (struct patch_record **) arena_alloc(&arena, sizeof(struct patch_record *) * new_capacity);
+    if (!index) {
+        return false;
+    }
+    struct patch_record **old_index = _patch_index;
+    _patch_index = index;
+    _patch_index_mask = new_capacity - 1;
+    for (size_t i = 0; i < capacity; i++) {
+        if (old_index[i]) {
+            _patch_index[find_patch_position(old_index[i]->slot)] = old_index[i];
+        }
+    }
+    arena_release(&_patch_index_arena);
+    _patch_index_arena = arena;
+    return true;
+}
+
+static void free_patch_layers(struct patch_record *record) {
+    while (record) {
+        struct patch_record *below = record->below;
+        record->below = _free_patches;
+        _free_patches = record;
+        record = below;
+    }
+}
+
+// 删除 position 处的 slot，之后同一探测序列上的条目前移填补空位，不留墓碑
+static void remove_patch_at(size_t position) {
+    size_t hole = position;
+    _patch_index[hole] = NULL;
+    for (size_t i = (hole + 1) & _patch_index_mask; _patch_index[i]; i = (i + 1) & _patch_index_mask) {
+        size_t home = patch_slot_hash(_patch_index[i]->slot) & _patch_index_mask;
+        if (((i - home) & _patch_index_mask) < ((i - hole) & _patch_index_mask)) {
+            continue;                                               // 起始位置在 (hole, i] 之间，不能前移
+        }
+        _patch_index[hole] = _patch_index[i];
+        _patch_index[i] = NULL;
+        hole = i;
+    }
+    _patch_count--;
+}
+
+// 日志写不进去时只是无法再还原这个 slot，不影响重绑定本身
+static void record_patch(const struct image_view *view,
+                         const struct pending_write *write,
+                         void *previous) {
+    const struct rebinding *rebinding = write->rebinding;
+    void **slot = write->slot;
+    if (previous == rebinding->replacement) {
+        return;                                                     // 重新扫描时写入了同样的值
+    }
+    struct patch_record *top = find_patch(slot);
+    if (!top && !reserve_patch_index()) {
+        return;
+    }
+    struct patch_record *record = _free_patches;
+    if (record) {
+        _free_patches = record->below;
+    } else {
+        record = (struct patch_record *) arena_alloc(&_patches_arena, sizeof(struct patch_record));
+        if (!record) {
+            return;
+        }
+    }
+    record->slot = slot;
+    record->view = view;
+    record->segment = write->segment;
+    record->is_auth = write->is_auth;
+    record->value = rebinding->replacement;
+    record->previous = previous;
+    record->replaced = rebinding->replaced;
+    record->below = top;                                            // slot 被别人改写过时旧的层仍然保留
+    record->checked_found = NULL;                                   // 记录可能来自空闲链表
+    _patch_index[find_patch_position(slot)] = record;
+    if (!top) {
+        _patch_count++;
+    }
+}
+
+static void forget_patches(const struct image_view *view) {
+    if (!_patch_index) {
+        return;
+    }
+    for (size_t i = 0; i <= _patch_index_mask; ) {
+        struct patch_record *record = _patch_index[i];
+        if (record && record->view == view) {
+            free_patch_layers(record);
+            remove_patch_at(i);                                     // 后面的条目可能前移到 i，需要再检查一次
+        } else {
+            i++;
+        }
+    }
+}
+
+// 每个可能只读的段只打开一个写窗口，覆盖其中第一个到最后一个待写 slot 所在的页
+static void apply_pending_writes(const struct image_view *view,
+                                 const struct pending_writes *writes,
+                                 struct arena *scratch) {
+    if (!writes->head) {
+        return;
+    }
+    uint32_t nel = view->segments_nel;
+    uintptr_t *window_starts = (uintptr_t *) arena_alloc(scratch, sizeof(uintptr_t) * (nel ? nel : 1));
+    uintptr_t *window_ends = (uintptr_t *) arena_alloc(scratch, sizeof(uintptr_t) * (nel ? nel : 1));
+    vm_prot_t *old_protections = (vm_prot_t *) arena_alloc(scratch, sizeof(vm_prot_t) * (nel ? nel : 1));
+    bool *opened = (bool *) arena_alloc(scratch, sizeof(bool) * (nel ? nel : 1));
+    if (!window_starts || !window_ends || !old_protections || !opened) {
+        return;
+    }
+    for (const struct pending_write_block *block = writes->head; block; block = block->next) {
+        for (size_t i = 0; i < block->count; i++) {
+            const struct pending_write *write = &block->entries[i];
+            uintptr_t start = (uintptr_t)write->slot;
+            uintptr_t end = start + sizeof(void *);
+            if (!window_ends[write->segment] || start < window_starts[write->segment]) {
+                window_starts[write->segment] = start;
+            }
+            if (end > window_ends[write->segment]) {
+                window_ends[write->segment] = end;
+            }
+        }
+    }
+    uintptr_t page_mask = (uintptr_t)getpagesize() - 1;
+    uint64_t mprotect_calls = 0;
+    uint64_t pages_unprotected = 0;
+    for (uint32_t i = 0; i < nel; i++) {
+        if (!window_ends[i] || !view->segments[i].may_be_read_only) {
+            continue;
+        }
+        window_starts[i] &= ~page_mask;
+        window_ends[i] = (window_ends[i] + page_mask) & ~page_mask;
+        size_t size = window_ends[i] - window_starts[i];
+        opened[i] = begin_writing((void *)window_starts[i], size, &old_protections[i]);
+        if (opened[i]) {
+            mprotect_calls++;
+            pages_unprotected += size / (page_mask + 1);
+        }
+    }
+    uint64_t slots_rebound = 0;
+    struct original_queue queue = { view, scratch, NULL };
+    for (const struct pending_write_block *block = writes->head; block; block = block->next) {
+        for (size_t i = 0; i < block->count; i++) {
+            const struct pending_write *write = &block->entries[i];
+            const struct rebinding *rebinding = write->rebinding;
+            if (!rebinding) {
+                write_symbol_pointer(write->is_auth, write->slot, write->value);    // 交换或还原，日志由调用方维护
+                continue;
+            }
+            void *previous = read_symbol_pointer(write->is_auth, write->slot);
+            rebind_slot(rebinding, write->is_auth, write->slot, previous);
+            if (write->lazy && rebinding->replaced != NULL && previous != rebinding->replacement &&
+                points_into_stub_helper(view, previous)) {
+                queue_original(&queue, rebinding->replaced, previous, write->symbol_name, write->library_ordinal);
+            }
+            record_patch(view, write, previous);
+            slots_rebound++;
+        }
+    }
+    for (uint32_t i = 0; i < nel; i++) {
+        if (opened[i]) {
+            end_writing((void *)window_starts[i], window_ends[i] - window_starts[i], old_protections[i]);
+            mprotect_calls++;
+        }
+    }
+    stats_add(&_counters->slots_rebound, slots_rebound);
+    stats_add(&_counters->mprotect_calls, mprotect_calls);
+    stats_add(&_counters->pages_unprotected, pages_unprotected);
+}
+
+static bool range_within(uint64_t offset, uint64_t size, uint64_t limit) {
+    return offset <= limit && size <= limit - offset;
+}
+
+static bool is_dylib_command(uint32_t cmd) {
+    return cmd == LC_LOAD_DYLIB ||
+           cmd == LC_LOAD_WEAK_DYLIB ||
+           cmd == LC_REEXPORT_DYLIB ||
+           cmd == LC_LOAD_UPWARD_DYLIB ||
+           cmd == LC_LAZY_LOAD_DYLIB;
+}
+
+// 段内的每个 section 都必须落在段自己的地址范围内，且间接符号索引全部有效
+static bool validate_symbol_pointer_section(const struct image_view *view,
+                                            const segment_command_t *segment,
+                                            const section_t *sect,
+                                            const uint32_t *indirect_symtab,
+                                            uint32_t nindirectsyms) {
+    uint64_t count = sect->size / sizeof(void *);
+    if (sect->addr < segment->vmaddr ||
+        !range_within(sect->addr - segment->vmaddr, sect->size, segment->vmsize) ||
+        !range_within(sect->reserved1, count, nindirectsyms)) {
+        return false;
+    }
+    for (uint64_t i = 0; i < count; i++) {
+        uint32_t symtab_index = indirect_symtab[sect->reserved1 + i];
+        if (symtab_index == INDIRECT_SYMBOL_ABS ||
+            symtab_index == INDIRECT_SYMBOL_LOCAL ||
+            symtab_index == (INDIRECT_SYMBOL_LOCAL | INDIRECT_SYMBOL_ABS)) {
+            continue;
+        }
+        if (symtab_index >= view->nsyms || view->symtab[symtab_index].n_un.n_strx >= view->strsize) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// 段在绑定完成后可能被 dyld 改为只读：没有写权限、带 SG_READ_ONLY 或名为 *_CONST
+static bool segment_may_be_read_only(const segment_command_t *segment) {
+    size_t segname_len = strnlen(segment->segname, sizeof(segment->segname));
+    return !(segment->initprot & VM_PROT_WRITE) ||
+           (segment->flags & SG_READ_ONLY) ||
+           (segname_len >= 6 && memcmp(segment->segname + segname_len - 6, "_CONST", 6) == 0);
+}
+
+// arm64e 上只有这两种 section 中的指针带签名，它们常常位于 __DATA_CONST 而不是 __AUTH* 段中
+static bool section_is_auth(const section_t *sect) {
+    return strncmp(sect->sectname, "__auth_got", sizeof(sect->sectname)) == 0 ||
+           strncmp(sect->sectname, "__auth_ptr", sizeof(sect->sectname)) == 0;
+}
+
+static bool segment_offset_is_auth(const struct image_segment *segment, uint64_t offset) {
+    for (uint32_t i = 0; i < segment->auth_ranges_nel; i++) {
+        if (offset - segment->auth_ranges[i].offset < segment->auth_ranges[i].size) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool read_uleb128(const uint8_t **p, const uint8_t *end, uint64_t *value) {
+    uint64_t result = 0;
+    unsigned shift = 0;
+    while (*p < end) {
+        uint8_t byte = *(*p)++;
+        if ((shift >= 64 && (byte & 0x7f)) || (shift == 63 && (byte & 0x7e))) {
+            return false;                                           // 超出 64 位
+        }
+        if (shift < 64) {
+            result |= (uint64_t)(byte & 0x7f) << shift;
+        }
+        shift += 7;
+        if (!(byte & 0x80)) {
+            *value = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool read_sleb128(const uint8_t **p, const uint8_t *end, int64_t *value) {
+    int64_t result = 0;
+    unsigned shift = 0;
+    while (*p < end) {
+        uint8_t byte = *(*p)++;
+        if (shift < 64) {
+            result |= (int64_t)((uint64_t)(byte & 0x7f) << shift);
+        }
+        shift += 7;
+        if (!(byte & 0x80)) {
+            if (shift < 64 && (byte & 0x40)) {
+                result |= -((int64_t)1 << shift);                   // 符号扩展
+            }
+            *value = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+struct bind_table {
+    struct bound_pointer_block *head;
+    struct bound_pointer_block *tail;
+    uint64_t remaining;             // 还能追加的条目数，不超过各段能容纳的指针总数
+};
+
+static bool append_bound_pointer(struct arena *arena, struct bind_table *table, const struct bound_pointer *entry) {
+    if (!table->tail || table->tail->count == BOUND_POINTER_BLOCK_SIZE) {
+        struct bound_pointer_block *block = (struct bound_pointer_block *) arena_alloc(arena, sizeof(struct bound_pointer_block));
+        if (!block) {
+            return false;
+        }
+        if (table->tail) {
+            table->tail->next = block;
+        } else {
+            table->head = block;
+        }
+        table->tail = block;
+    }
+    table->tail->entries[table->tail->count++] = *entry;
+    return true;
+}
+
+/*
+ * Decodes one bind (or lazy bind) opcode stream, appending every pointer-typed
+ * bind that lands on an aligned slot inside a known segment. Lazy bind streams
+ * use BIND_OPCODE_DONE as a separator between entries rather than a
+ * terminator. Threaded (chained) binds are not supported and end decoding.
+ * Returns false on malformed input.
+ */
+static bool decode_bind_opcodes(struct arena *arena,
+                                struct bind_table *table,
+                                const uint8_t *p,
+                                const uint8_t *end,
+                                bool lazy,
+                                const struct image_segment *segments,
+                                uint32_t segments_nel) {
+    const char *symbol_name = NULL;
+    int64_t library_ordinal = 0;
+    uint8_t type = BIND_TYPE_POINTER;
+    int64_t addend = 0;
+    uint32_t segment = UINT32_MAX;
+    uint64_t offset = 0;
+    const uint64_t pointer_size = sizeof(void *);
+    
+    while (p < end) {
+        uint8_t immediate = *p & BIND_IMMEDIATE_MASK;
+        uint8_t opcode = *p & BIND_OPCODE_MASK;
+        p++;
+        uint64_t count = 1;
+        uint64_t skip = 0;
+        uint64_t value;
+        switch (opcode) {
+            case BIND_OPCODE_DONE:
+                if (!lazy) {
+                    return true;
+                }
+                continue;                                           // 懒绑定流中 DONE 只是条目之间的分隔
+            case BIND_OPCODE_SET_DYLIB_ORDINAL_IMM:
+                library_ordinal = immediate;
+                continue;
+            case BIND_OPCODE_SET_DYLIB_ORDINAL_ULEB:
+                if (!read_uleb128(&p, end, &value)) {
+                    return false;
+                }
+                library_ordinal = (int64_t)value;
+                continue;
+            case BIND_OPCODE_SET_DYLIB_SPECIAL_IMM:
+                library_ordinal = immediate ? (int8_t)(BIND_OPCODE_MASK | immediate) : 0;
+                continue;
+            case BIND_OPCODE_SET_SYMBOL_TRAILING_FLAGS_IMM: {
+                const uint8_t *terminator = (const uint8_t *)memchr(p, '\0', (size_t)(end - p));
+                if (!terminator) {
+                    return false;
+                }
+                symbol_name = (const char *)p;
+                p = terminator + 1;
+                continue;
+            }
+            case BIND_OPCODE_SET_TYPE_IMM:
+                type = immediate;
+                continue;
+            case BIND_OPCODE_SET_ADDEND_SLEB:
+                if (!read_sleb128(&p, end, &addend)) {
+                    return false;
+                }
+                continue;
+            case BIND_OPCODE_SET_SEGMENT_AND_OFFSET_ULEB:
+                if (!read_uleb128(&p, end, &offset)) {
+                    return false;
+                }
+                segment = immediate;
+                continue;
+            case BIND_OPCODE_ADD_ADDR_ULEB:
+                if (!read_uleb128(&p, end, &value)) {
+                    return false;
+                }
+                offset += value;
+                continue;
+            case BIND_OPCODE_DO_BIND:
+                skip = 0;
+                break;
+            case BIND_OPCODE_DO_BIND_ADD_ADDR_ULEB:
+                if (!read_uleb128(&p, end, &skip)) {
+                    return false;
+                }
+                break;
+            case BIND_OPCODE_DO_BIND_ADD_ADDR_IMM_SCALED:
+                skip = (uint64_t)immediate * pointer_size;
+                break;
+            case BIND_OPCODE_DO_BIND_ULEB_TIMES_SKIPPING_ULEB:
+                if (!read_uleb128(&p, end, &count) || !read_uleb128(&p, end, &skip)) {
+                    return false;
+                }
+                break;
+            default:
+                return opcode == BIND_OPCODE_THREADED;              // 链式绑定不支持，已解码的部分仍然可用
+        }
+        
+        // 单次绑定时允许回绕，ld64 用它表示向低地址移动；重复绑定时回绕会让 offset 原地打转
+        uint64_t step = pointer_size + skip;
+        if (count > 1 && step < pointer_size) {
+            return false;
+        }
+        // 重复绑定时 offset 每次至少前进一个指针，出了段就停止，循环次数受段大小约束
+        for (uint64_t i = 0; i < count; i++) {
+            if (segment >= segments_nel || !range_within(offset, pointer_size, segments[segment].size)) {
+                break;
+            }
+            if (symbol_name && type == BIND_TYPE_POINTER && addend == 0 && offset % pointer_size == 0) {
+                if (table->remaining == 0) {
+                    return false;                                   // 条目比段中能放下的指针还多，必然是畸形输入
+                }
+                table->remaining--;
+                struct bound_pointer entry = {
+                    (void **)(segments[segment].start + offset),
+                    symbol_name,
+                    library_ordinal > 0 ? (uint32_t)library_ordinal : 0,
+                    segment,
+                    NULL,
+                    lazy,
+                    segment_offset_is_auth(&segments[segment], offset),
+                };
+                if (!append_bound_pointer(arena, table, &entry)) {
+                    return false;
+                }
+            }
+            if (count > 1 && step > UINT64_MAX - offset) {
+                break;
+            }
+            offset += step;
+        }
+    }
+    return true;
+}
+
+static bool build_bind_table(struct image_view *view,
+                             struct arena *arena,
+                             const struct dyld_info_command *dyld_info_cmd,
+                             const segment_command_t *linkedit_segment) {
+    uint64_t linkedit_start = linkedit_segment->fileoff;
+    uint64_t linkedit_size = linkedit_segment->filesize;
+    if (linkedit_size > linkedit_segment->vmsize ||
+        dyld_info_cmd->bind_off < linkedit_start ||
+        !range_within(dyld_info_cmd->bind_off - linkedit_start, dyld_info_cmd->bind_size, linkedit_size) ||
+        dyld_info_cmd->lazy_bind_off < linkedit_start ||
+        !range_within(dyld_info_cmd->lazy_bind_off - linkedit_start, dyld_info_cmd->lazy_bind_size, linkedit_size)) {
+        return false;
+    }
+    uintptr_t linkedit_base = (uintptr_t)view->slide + linkedit_segment->vmaddr - linkedit_segment->fileoff;
+    const uint8_t *bind = (const uint8_t *)(linkedit_base + dyld_info_cmd->bind_off);
+    const uint8_t *lazy_bind = (const uint8_t *)(linkedit_base + dyld_info_cmd->lazy_bind_off);
+    struct bind_table table = { NULL, NULL, 0 };
+    for (uint32_t i = 0; i < view->segments_nel; i++) {
+        table.remaining += view->segments[i].size / sizeof(void *);
+    }
+    if (!decode_bind_opcodes(arena, &table, bind, bind + dyld_info_cmd->bind_size, false,
+                             view->segments, view->segments_nel) ||
+        !decode_bind_opcodes(arena, &table, lazy_bind, lazy_bind + dyld_info_cmd->lazy_bind_size, true,
+                             view->segments, view->segments_nel)) {
+        return false;
+    }
+    view->binds = table.head;
+    return true;
+}
+
+static struct image_view *build_image_view(struct arena *arena,
+                                           const struct mach_header *header,
+                                           intptr_t slide) {
+    if (header->magic != MH_MAGIC_ARCH_DEPENDENT) {
+        return NULL;
+    }
+    segment_command_t *cur_seg_cmd;
+    segment_command_t *linkedit_segment = NULL;
+    struct symtab_command* symtab_cmd = NULL;
+    struct dysymtab_command* dysymtab_cmd = NULL;
+    struct dyld_info_command *dyld_info_cmd = NULL;
+    uint32_t dylib_count = 0;
+    uint32_t segment_count = 0;
+    uint32_t section_count = 0;
+    uintptr_t cmds = (uintptr_t)header + sizeof(mach_header_t);     // 跳过 Mach-O Header
+    uintptr_t cmds_end = cmds + header->sizeofcmds;
+    uintptr_t cur = cmds;
+    // 第一遍：校验每一个 Load Command 的大小，得到 SEG_LINKEDIT、LC_SYMTAB、LC_DYSYMTAB 以及依赖库
+    for (uint i = 0; i < header->ncmds; i++, cur += cur_seg_cmd->cmdsize) {
+        cur_seg_cmd = (segment_command_t *)cur;                     // 取出当前的 Load Command
+        if (!range_within(cur - cmds, sizeof(struct load_command), cmds_end - cmds) ||
+            cur_seg_cmd->cmdsize < sizeof(struct load_command) ||
+            !range_within(cur - cmds, cur_seg_cmd->cmdsize, cmds_end - cmds)) {
+            return NULL;
+        }
+        if (cur_seg_cmd->cmd == LC_SEGMENT_ARCH_DEPENDENT) {
+            if (cur_seg_cmd->cmdsize < sizeof(segment_command_t) ||
+                (cur_seg_cmd->cmdsize - sizeof(segment_command_t)) / sizeof(section_t) < cur_seg_cmd->nsects) {
+                return NULL;
+            }
+            if (strncmp(cur_seg_cmd->segname, SEG_LINKEDIT, sizeof(cur_seg_cmd->segname)) == 0) {  // SEG_LINKEDIT：加载命令信息
+                linkedit_segment = cur_seg_cmd;
+            }
+            segment_count++;
+            section_count += cur_seg_cmd->nsects;
+        } else if (cur_seg_cmd->cmd == LC_SYMTAB) {                 // LC_SYMTAB：链接器信息
+            if (cur_seg_cmd->cmdsize < sizeof(struct symtab_command)) {
+                return NULL;
+            }
+            symtab_cmd = (struct symtab_command*)cur_seg_cmd;
+        } else if (cur_seg_cmd->cmd == LC_DYSYMTAB) {               // LC_DYSYMTAB：动态链接器信息
+            if (cur_seg_cmd->cmdsize < sizeof(struct dysymtab_command)) {
+                return NULL;
+            }
+            dysymtab_cmd = (struct dysymtab_command*)cur_seg_cmd;
+        } else if (cur_seg_cmd->cmd == LC_DYLD_INFO || cur_seg_cmd->cmd == LC_DYLD_INFO_ONLY) {  // 压缩的绑定信息
+            if (cur_seg_cmd->cmdsize < sizeof(struct dyld_info_command)) {
+                return NULL;
+            }
+            dyld_info_cmd = (struct dyld_info_command *)cur_seg_cmd;
+        } else if (is_dylib_command(cur_seg_cmd->cmd)) {            // 依赖库，出现顺序即库序号
+            struct dylib_command *dylib_cmd = (struct dylib_command *)cur_seg_cmd;
+            if (cur_seg_cmd->cmdsize < sizeof(struct dylib_command) ||
+                dylib_cmd->dylib.name.offset >= cur_seg_cmd->cmdsize ||
+                !memchr((const char *)dylib_cmd + dylib_cmd->dylib.name.offset, '\0',
+                        cur_seg_cmd->cmdsize - dylib_cmd->dylib.name.offset)) {
+                return NULL;
+            }
+            dylib_count++;
+        }
+    }
+    
+    struct image_view *view = (struct image_view *) arena_alloc(arena, sizeof(struct image_view));
+    if (!view) {
+        return NULL;
+    }
+    view->header = header;
+    view->slide = slide;
+    view->dylib_names = (const char **) arena_alloc(arena, sizeof(const char *) * (dylib_count ? dylib_count : 1));
+    view->segments = (struct image_segment *) arena_alloc(arena, sizeof(struct image_segment) * (segment_count ? segment_count : 1));
+    if (!view->dylib_names || !view->segments) {
+        return NULL;
+    }
+    cur = cmds;
+    for (uint i = 0; i < header->ncmds; i++, cur += cur_seg_cmd->cmdsize) {
+        cur_seg_cmd = (segment_command_t *)cur;
+        if (is_dylib_command(cur_seg_cmd->cmd) && view->dylib_count < MAX_LIBRARY_ORDINAL) {
+            struct dylib_command *dylib_cmd = (struct dylib_command *)cur_seg_cmd;
+            view->dylib_names[view->dylib_count++] = (const char *)dylib_cmd + dylib_cmd->dylib.name.offset;
+        } else if (cur_seg_cmd->cmd == LC_SEGMENT_ARCH_DEPENDENT) {
+            // 段名仅用于判断权限，签名按 section 判断，每个镜像只判断一次
+            struct image_segment *segment = &view->segments[view->segments_nel++];
+            segment->start = (uintptr_t)slide + cur_seg_cmd->vmaddr;
+            segment->size = cur_seg_cmd->vmsize;
+            segment->may_be_read_only = segment_may_be_read_only(cur_seg_cmd);
+            segment->is_writable = (cur_seg_cmd->initprot & VM_PROT_WRITE) != 0;
+            segment->file_size = cur_seg_cmd->filesize < cur_seg_cmd->vmsize ? cur_seg_cmd->filesize : cur_seg_cmd->vmsize;
+            uint32_t auth_count = 0;
+            for (uint j = 0; j < cur_seg_cmd->nsects; j++) {
+                auth_count += section_is_auth((section_t *)(cur + sizeof(segment_command_t)) + j);
+            }
+            struct auth_range *auth_ranges = NULL;
+            if (auth_count) {
+                auth_ranges = (struct auth_range *) arena_alloc(arena, sizeof(struct auth_range) * auth_count);
+                if (!auth_ranges) {
+                    return NULL;
+                }
+            }
+            segment->auth_ranges = auth_ranges;
+            for (uint j = 0; j < cur_seg_cmd->nsects; j++) {
+                section_t *sect = (section_t *)(cur + sizeof(segment_command_t)) + j;
+                if (section_is_auth(sect) && sect->addr >= cur_seg_cmd->vmaddr &&
+                    range_within(sect->addr - cur_seg_cmd->vmaddr, sect->size, cur_seg_cmd->vmsize)) {
+                    auth_ranges[segment->auth_ranges_nel++] = (struct auth_range){ sect->addr - cur_seg_cmd->vmaddr, sect->size };
+                }
+                if (strncmp(sect->sectname, "__stub_helper", sizeof(sect->sectname)) == 0 &&
+                    strncmp(cur_seg_cmd->segname, SEG_TEXT, sizeof(cur_seg_cmd->segname)) == 0 &&
+                    sect->addr >= cur_seg_cmd->vmaddr &&
+                    range_within(sect->addr - cur_seg_cmd->vmaddr, sect->size, cur_seg_cmd->vmsize)) {
+                    view->stub_helper_start = (uintptr_t)slide + sect->addr;
+                    view->stub_helper_size = sect->size;
+                }
+            }
+        }
+    }
+    if (!symtab_cmd || !dysymtab_cmd || !linkedit_segment ||
+        !dysymtab_cmd->nindirectsyms) {
+        // 没有间接符号表时退而解码绑定操作码；两者都没有的镜像同样缓存下来
+        if (dyld_info_cmd && linkedit_segment &&
+            !build_bind_table(view, arena, dyld_info_cmd, linkedit_segment)) {
+            return NULL;
+        }
+        return view;
+    }
+    
+    /*
+        slide: ASLR 偏移量
+        vmaddr: SEG_LINKEDIT 的虚拟地址
+        fileoff: SEG_LINKEDIT 地址偏移
+        虚拟地址偏移量 = 虚拟地址（vmaddr） - 地址移量（fileoff）
+        段基址 = ASLR的偏移量（slide） + 虚拟地址偏移量
+     */
+    
+    // 符号表、字符表、间接符号表都必须完整地落在 SEG_LINKEDIT 中；段本身的地址由 dyld 映射，视为可信
+    uint64_t linkedit_start = linkedit_segment->fileoff;
+    uint64_t linkedit_size = linkedit_segment->filesize;
+    if (linkedit_size > linkedit_segment->vmsize ||
+        symtab_cmd->symoff < linkedit_start ||
+        !range_within(symtab_cmd->symoff - linkedit_start, (uint64_t)symtab_cmd->nsyms * sizeof(nlist_t), linkedit_size) ||
+        symtab_cmd->stroff < linkedit_start ||
+        !range_within(symtab_cmd->stroff - linkedit_start, symtab_cmd->strsize, linkedit_size) ||
+        dysymtab_cmd->indirectsymoff < linkedit_start ||
+        !range_within(dysymtab_cmd->indirectsymoff - linkedit_start, (uint64_t)dysymtab_cmd->nindirectsyms * sizeof(uint32_t), linkedit_size) ||
+        !range_within(dysymtab_cmd->iundefsym, dysymtab_cmd->nundefsym, symtab_cmd->nsyms) ||
+        symtab_cmd->strsize == 0) {
+        return NULL;
+    }
+    
+    // Find base symbol/string table addresses
+    uintptr_t linkedit_base = (uintptr_t)slide + linkedit_segment->vmaddr - linkedit_segment->fileoff;
+    // 计算 symbol table 表的首地址
+    view->symtab = (nlist_t *)(linkedit_base + symtab_cmd->symoff);
+    view->nsyms = symtab_cmd->nsyms;
+    // 计算 string table 首地址
+    view->strtab = (char *)(linkedit_base + symtab_cmd->stroff);
+    view->strsize = symtab_cmd->strsize;
+    if (view->strtab[view->strsize - 1] != '\0') {
+        return NULL;                                                // 保证任何 n_strx < strsize 的字符串都有结尾
+    }
+    view->iundefsym = dysymtab_cmd->iundefsym;
+    view->nundefsym = dysymtab_cmd->nundefsym;
+    for (uint32_t i = 0; i < view->nundefsym; i++) {
+        if (view->symtab[view->iundefsym + i].n_un.n_strx >= view->strsize) {
+            return NULL;
+        }
+    }
+    
+    // 计算 indirect symbol table 的首地址
+    // Get indirect symbol table (array of uint32_t indices into symbol table)
+    uint32_t *indirect_symtab = (uint32_t *)(linkedit_base + dysymtab_cmd->indirectsymoff);
+    
+    view->sections = (struct symbol_pointer_section *) arena_alloc(arena, sizeof(struct symbol_pointer_section) * (section_count ? section_count : 1));
+    if (!view->sections) {
+        return NULL;
+    }
+    
+    // 第二遍：Load Commands 已校验，收集所有段中的符号指针 section（__DATA、__DATA_CONST、__DATA_DIRTY、__AUTH、__AUTH_CONST 等）
+    cur = cmds;
+    uint32_t segment_index = 0;
+    for (uint i = 0; i < header->ncmds; i++, cur += cur_seg_cmd->cmdsize) {
+        cur_seg_cmd = (segment_command_t *)cur;
+        if (cur_seg_cmd->cmd != LC_SEGMENT_ARCH_DEPENDENT) {
+            continue;
+        }
+        uint32_t segment = segment_index++;                         // 只按 section 类型识别，不看段名
+        // 遍历 Segment command 中的 Section
+        for (uint j = 0; j < cur_seg_cmd->nsects; j++) {
+            section_t *sect = (section_t *)(cur + sizeof(segment_command_t)) + j;
+            uint32_t section_type = sect->flags & SECTION_TYPE;     // 获取记录类型
+            // 只收集懒加载和非懒加载符号指针，校验不通过的 section 直接跳过
+            if ((section_type != S_LAZY_SYMBOL_POINTERS &&
+                 section_type != S_NON_LAZY_SYMBOL_POINTERS &&
+                 section_type != S_LAZY_DYLIB_SYMBOL_POINTERS) ||
+                !validate_symbol_pointer_section(view, cur_seg_cmd, sect, indirect_symtab, dysymtab_cmd->nindirectsyms)) {
+                continue;
+            }
+            struct symbol_pointer_section *section = &view->sections[view->sections_nel++];
+            section->bindings = (void **)((uintptr_t)slide + sect->addr);
+            section->indices = indirect_symtab + sect->reserved1;   // sect->reserved1 为 Section 在间接符号表中的起始条目
+            section->count = sect->size / sizeof(void *);
+            section->segment = segment;
+            section->lazy = section_type == S_LAZY_SYMBOL_POINTERS;
+            section->is_auth = section_is_auth(sect);
+        }
+    }
+    return view;
+}
+
+// 已校验过的镜像，调用方需持有锁
+static struct image_view *_image_views;
+static struct arena _image_views_arena;
+static pthread_once_t _forget_image_view_once = PTHREAD_ONCE_INIT;    // 缓存清空后不能再注册一次
+
+static void _forget_image_view(const struct mach_header *header,
+                               intptr_t slide) {
+    if (lock_rebindings()) {
+        for (struct image_view **cur = &_image_views; *cur; cur = &(*cur)->next) {
+            if ((*cur)->header == header && (*cur)->slide == slide) {
+                forget_patches(*cur);
+                *cur = (*cur)->next;                                // 内存留在 arena 中，镜像卸载很少发生
+                break;
+            }
+        }
+    }
+    unlock_rebindings();
+}
+
+// 镜像卸载时丢弃对应缓存；在加锁之前调用，dyld 注册时会持有自己的锁
+static void register_forget_image_view(void) {
+    _dyld_register_func_for_remove_image(_forget_image_view);
+}
+
+static struct image_view *get_image_view(const struct mach_header *header,
+                                         intptr_t slide) {
+    for (struct image_view *view = _image_views; view; view = view->next) {
+        if (view->header == header && view->slide == slide) {
+            return view->rejected ? NULL : view;
+        }
+    }
+    // 先在临时 arena 中构建，校验通过后才并入全局 arena，失败时中途分配的内存随之释放
+    struct arena build_arena = {0};
+    struct image_view *view = build_image_view(&build_arena, header, slide);
+    if (view) {
+        arena_adopt(&_image_views_arena, &build_arena);
+    } else {
+        arena_release(&build_arena);
+        view = (struct image_view *) arena_alloc(&_image_views_arena, sizeof(struct image_view));
+        if (!view) {
+            return NULL;
+        }
+        view->header = header;
+        view->slide = slide;
+        view->rejected = true;
+    }
+    view->next = _image_views;
+    _image_views = view;
+    return view->rejected ? NULL : view;
+}
+
+// 与 collect_section_writes 相同的匹配逻辑，作用于绑定操作码解码出的指针表
+static bool collect_bind_writes(const struct rebinding_plan *plan,
+                                const struct image_view *view,
+                                struct arena *scratch,
+                                struct pending_writes *writes) {
+    uint64_t slots_scanned = 0;
+    bool ok = true;
+    for (const struct bound_pointer_block *block = view->binds; block && ok; block = block->next) {
+        for (size_t i = 0; i < block->count; i++) {
+            const struct bound_pointer *bound = &block->entries[i];
+            slots_scanned++;
+            const struct plan_entry *match = lookup_symbol(plan, bound->symbol_name, bound->library_ordinal);
+            if (bound->demangled) {
+                const struct plan_entry *cxx_match = lookup_cxx_symbol(plan, bound->demangled, bound->library_ordinal);
+                if (cxx_match && (!match || cxx_match->precedence < match->precedence)) {
+                    match = cxx_match;
+                }
+            }
+            if (!match) {
+                continue;
+            }
+            struct pending_write write = { bound->slot, match->rebinding, bound->segment, bound->symbol_name, bound->library_ordinal, bound->lazy, NULL, bound->is_auth };
+            if (!append_pending_write(scratch, writes, &write)) {
+                ok = false;
+                break;
+            }
+        }
+    }
+    stats_add(&_counters->slots_scanned, slots_scanned);
+    return ok;
+}
+
+static void rebind_symbols_for_image(const struct rebinding_plan *plan,
+                                     const struct mach_header *header,
+                                     intptr_t slide) {
+    uint64_t start_ns = stats_now_ns();
+    struct image_view *view = get_image_view(header, slide);
+    if (!view || (!view->sections_nel && !view->binds)) {
+        return;
+    }
+    
+    resolve_library_ordinals(plan, view->dylib_names, view->dylib_count);
+    
+    struct arena scratch = {0};                                     // 镜像级临时数据，处理完即释放
+    struct pending_writes writes = { NULL, NULL };
+    if (plan->cxx_count) {
+        demangle_image_symbols(view, &_image_views_arena);          // 每个镜像只 demangle 一次
+    }
+    if (view->binds) {
+        collect_bind_writes(plan, view, &scratch, &writes);
+    } else {
+        // 先在所有符号指针 section 中收集匹配的 slot，再统一写入
+        for (size_t i = 0; i < view->sections_nel; i++) {
+            if (!collect_section_writes(plan, view, &view->sections[i], &scratch, &writes)) {
+                break;
+            }
+        }
+    }
+    // 收集失败时已收集到的 slot 仍然写入，与逐个 section 写入时的行为一致
+    apply_pending_writes(view, &writes, &scratch);
+    arena_release(&scratch);
+    stats_add(&_counters->images_scanned, 1);
+    stats_add(&_counters->scan_ns, stats_now_ns() - start_ns);
+}
+
+struct rebind_async {
+    struct arena arena;                     // handle 自身也分配在这里
+    pthread_t thread;
+    bool has_thread;
+    int retval;
+    bool needs_registration;                // 首次调用，由后台线程注册 dyld 回调
+    const struct mach_header **sync_headers;// 已在调用线程上同步处理过的镜像
+    size_t sync_headers_nel;
+    rebind_image_callback_t image_callback;
+    void *context;
+};
+
+// 后台线程注册 dyld 回调期间指向对应的 handle；dyld 在注册线程上回放已加载的镜像，不需要加锁
+static __thread struct rebind_async *_registering_async;
+
+static bool async_handled_synchronously(const struct rebind_async *async,
+                                        const struct mach_header *header) {
+    for (size_t i = 0; i < async->sync_headers_nel; i++) {
+        if (async->sync_headers[i] == header) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// 逐个镜像加锁，image_callback 在解锁之后调用，回调中可以再调用 fishhook
+static void rebind_async_image(struct rebind_async *async,
+                               const struct mach_header *header,
+                               intptr_t slide) {
+    bool rebound = false;
+    if (lock_rebindings()) {
+        const struct rebinding_plan *plan = current_rebinding_plan();
+        if (plan && !async_handled_synchronously(async, header)) {
+            rebind_symbols_for_image(plan, header, slide);
+            rebound = true;
+        }
+    }
+    unlock_rebindings();
+    if (rebound && async->image_callback) {
+        async->image_callback(header, slide, async->context);
+    }
+}
+
+static void _rebind_symbols_for_image(const struct mach_header *header,
+                                      intptr_t slide) {
+    if (_registering_async) {
+        rebind_async_image(_registering_async, header, slide);
+        return;
+    }
+    if (lock_rebindings()) {                // 子进程中的状态不可信时什么都不做
+        const struct rebinding_plan *plan = current_rebinding_plan();
+        if (plan) {
+            rebind_symbols_for_image(plan, header, slide);
+        }
+    }
+    unlock_rebindings();
+}
+
+int rebind_symbols_image(void *header,
+                         intptr_t slide,
+                         struct rebinding rebindings[],
+                         size_t rebindings_nel) {
+    struct rebindings_entry *rebindings_head = NULL;
+    struct arena arena = {0};
+    struct rebinding_plan plan;
+    pthread_once(&_forget_image_view_once, register_forget_image_view);
+    int retval = prepend_rebindings(&rebindings_head, &arena, rebindings, rebindings_nel);
+    Dl_info info;
+    // dladdr 会持有 dyld 的锁，必须在加锁之前确认 header 是已加载的镜像
+    if (retval == 0 && dladdr(header, &info) != 0 && build_rebinding_plan(&plan, rebindings_head)) {
+        if (lock_rebindings()) {            // 镜像缓存是全局共享的
+            rebind_symbols_for_image(&plan, (const struct mach_header *) header, slide);
+        } else {
+            retval = -1;
+        }
+        unlock_rebindings();
+        arena_release(&plan.arena);
+    }
+    arena_release(&arena);
+    return retval;
+}
+
+int rebind_symbols(struct rebinding rebindings[], size_t rebindings_nel) {
+    pthread_once(&_forget_image_view_once, register_forget_image_view);
+    int retval = -1;
+    bool first = false;
+    if (lock_rebindings()) {
+        retval = prepend_rebindings(&_rebindings_head, &_rebindings_arena, rebindings, rebindings_nel);
+    }
+    if (retval == 0) {
+        _rebindings_generation++;
+        first = !_rebindings_head->next;    // NULL == _rebindings_head->next 代表第一次调用
+    }
+    unlock_rebindings();
+    if (retval < 0) {
+        return retval;
+    }
+    // dyld 持有自己的锁调用回调，回调再逐个镜像加锁，所以以下都在锁外进行
+    if (first) {
+        // 第一次调用，注册 _rebind_symbols_for_image 回调，当 dyld 链接符号时，调用此回调函数
         _dyld_register_func_for_add_image(_rebind_symbols_for_image);   // 已经加载了某些镜像，会分别对这些加载完毕的镜像调用注册的回调
     } else {
+        // 与首次调用的注册并发时，两边都处理到的镜像会再扫描一遍，写入的值不变
         uint32_t c = _dyld_image_count();       // 先获取 dyld 镜像数量
         for (uint32_t i = 0; i < c; i++) {      // 根据下标依次进行重绑定过程，参数 Mach-O 头，ASLR偏移量
-            _rebind_symbols_for_image(_dyld_get_image_header(i), _dyld_get_image_vmaddr_slide(i));
+            const struct mach_header *header = _dyld_get_image_header(i);
+            if (header) {                       // 期间有镜像卸载时下标会越界
+                _rebind_symbols_for_image(header, _dyld_get_image_vmaddr_slide(i));
+            }
+        }
+    }
+    return retval;
+}
+
+struct patch_update {
+    struct patch_record *record;
+    void *value;                    // 要写入 record->slot 的值
+    void *found;                    // 写入前 slot 中不属于日志的值，只在重新接管时使用
+};
+
+static int compare_updates_by_view(const void *a, const void *b) {
+    uintptr_t x = (uintptr_t)((const struct patch_update *)a)->record->view;
+    uintptr_t y = (uintptr_t)((const struct patch_update *)b)->record->view;
+    return x < y ? -1 : x > y;
+}
+
+// 按镜像分组写入，每个镜像的只读段只打开一次；返回实际写入的前缀长度，updates 会被重新排序
+static size_t write_patch_updates(struct patch_update *updates, size_t count, struct arena *scratch) {
+    qsort(updates, count, sizeof(struct patch_update), compare_updates_by_view);
+    for (size_t start = 0; start < count; ) {
+        const struct image_view *view = updates[start].record->view;
+        struct pending_writes writes = { NULL, NULL };
+        size_t end = start;
+        for (; end < count && updates[end].record->view == view; end++) {
+            const struct patch_record *record = updates[end].record;
+            struct pending_write write = { record->slot, NULL, record->segment, NULL, 0, false, updates[end].value, record->is_auth };
+            if (!append_pending_write(scratch, &writes, &write)) {
+                count = end;
+                break;
+            }
         }
+        apply_pending_writes(view, &writes, scratch);
+        start = end;
+    }
+    return count;
+}
+
+static void *read_patch_slot(const struct patch_record *record) {
+    return read_symbol_pointer(record->is_auth, record->slot);
+}
+
+/*
+ * Layers below the top of a slot are not visible in memory, only in the log.
+ * On restore, a layer that wrote replacement is unlinked, and the layer above
+ * it, which saved replacement as its previous value, inherits the value from
+ * before it. On swap, the layers keep their place and only their values change.
+ */
+static void rewrite_lower_layers(struct patch_record *top, void *replacement, void *new_replacement, bool restore) {
+    struct patch_record *upper = top;
+    while (upper->below) {
+        struct patch_record *lower = upper->below;
+        if (restore && lower->value == replacement) {
+            if (upper->previous == replacement) {
+                upper->previous = lower->previous;
+                if (upper->replaced && *upper->replaced == replacement) {
+                    *upper->replaced = lower->previous;             // 上层的 hook 不再转发到被移除的 replacement
+                }
+            }
+            upper->below = lower->below;
+            lower->below = NULL;
+            free_patch_layers(lower);
+            continue;                                               // 同一个 upper 继续检查新的下一层
+        }
+        if (!restore) {
+            if (lower->value == replacement) {
+                lower->value = new_replacement;
+            }
+            if (upper->previous == replacement) {
+                upper->previous = new_replacement;
+                if (upper->replaced && *upper->replaced == replacement) {
+                    *upper->replaced = new_replacement;
+                }
+            }
+        }
+        upper = lower;
+    }
+}
+
+// 移除 slot 最上面的一层，露出下面一层
+static void pop_patch_layer(struct patch_record *record) {
+    size_t position = find_patch_position(record->slot);
+    if (record->below) {
+        _patch_index[position] = record->below;
+        record->below = NULL;
+    } else {
+        remove_patch_at(position);
+    }
+    free_patch_layers(record);
+}
+
+/*
+ * Points the slots that still hold replacement at new_replacement, or on restore
+ * at the value they held before, and returns how many were rewritten. Slots
+ * that someone else has written over since are left alone, but their log is
+ * updated all the same, so that rebind_symbols_verify neither reports them
+ * forever nor rechains them back to a replacement that was swapped out or
+ * detached.
+ */
+static int rewrite_patches(void *replacement, void *new_replacement, bool restore) {
+    if (!_patch_index) {
+        return 0;
+    }
+    struct arena scratch = {0};
+    struct patch_update *updates = (struct patch_update *) arena_alloc(&scratch, sizeof(struct patch_update) * (_patch_count ? _patch_count : 1));
+    struct patch_record **drifted = (struct patch_record **) arena_alloc(&scratch, sizeof(struct patch_record *) * (_patch_count ? _patch_count : 1));
+    if (!updates || !drifted) {
+        arena_release(&scratch);
+        return -1;
+    }
+    size_t count = 0;
+    size_t drifted_count = 0;
+    for (size_t i = 0; i <= _patch_index_mask; i++) {
+        struct patch_record *record = _patch_index[i];
+        if (!record) {
+            continue;
+        }
+        rewrite_lower_layers(record, replacement, new_replacement, restore);
+        if (record->value != replacement) {
+            continue;
+        }
+        if (read_patch_slot(record) != replacement) {
+            drifted[drifted_count++] = record;                      // 被覆盖的 slot 只改日志，遍历结束后再处理
+            continue;
+        }
+        updates[count].record = record;
+        updates[count].value = restore ? record->previous : new_replacement;
+        updates[count].found = NULL;
+        count++;
+    }
+    count = write_patch_updates(updates, count, &scratch);          // 只维护已经写入的部分
+    for (size_t i = 0; i < count; i++) {
+        if (restore) {
+            pop_patch_layer(updates[i].record);
+        } else {
+            updates[i].record->value = new_replacement;
+        }
+    }
+    for (size_t i = 0; i < drifted_count; i++) {
+        if (restore) {
+            pop_patch_layer(drifted[i]);
+        } else {
+            drifted[i]->value = new_replacement;                    // 重新接管时写回的是新的 replacement
+        }
+    }
+    arena_release(&scratch);
+    return (int)count;
+}
+
+int rebind_symbols_swap(void *replacement, void *new_replacement) {
+    if (!lock_rebindings()) {
+        unlock_rebindings();
+        return -1;
+    }
+    // 之后加载的镜像直接使用新的 replacement；plan 中引用的是同一份 rebinding，无需重建
+    for (struct rebindings_entry *entry = _rebindings_head; entry; entry = entry->next) {
+        for (size_t i = 0; i < entry->rebindings_nel; i++) {
+            if (entry->rebindings[i].replacement == replacement) {
+                entry->rebindings[i].replacement = new_replacement;
+            }
+        }
+    }
+    int retval = rewrite_patches(replacement, new_replacement, false);
+    unlock_rebindings();
+    return retval;
+}
+
+int rebind_symbols_detach(void *replacement) {
+    if (!lock_rebindings()) {
+        unlock_rebindings();
+        return -1;
+    }
+    bool removed = false;
+    for (struct rebindings_entry *entry = _rebindings_head; entry; entry = entry->next) {
+        size_t kept = 0;
+        for (size_t i = 0; i < entry->rebindings_nel; i++) {
+            if (entry->rebindings[i].replacement == replacement) {
+                removed = true;
+                continue;
+            }
+            entry->rebindings[kept] = entry->rebindings[i];
+            entry->names[kept] = entry->names[i];
+            kept++;
+        }
+        entry->rebindings_nel = kept;                               // 空的 entry 保留在链表中
+    }
+    if (removed) {
+        _rebindings_generation++;                                   // plan 引用了被移动的 rebinding，需要重建
+    }
+    int retval = rewrite_patches(replacement, NULL, true);
+    unlock_rebindings();
+    return retval;
+}
+
+static void *strip_code_pointer(void *pointer) {
+#if __has_feature(ptrauth_calls)
+    pointer = ptrauth_strip(pointer, ptrauth_key_function_pointer);
+#endif
+    return pointer;
+}
+
+static bool is_logged_value(void *pointer) {
+    for (size_t i = 0; i <= _patch_index_mask; i++) {
+        for (struct patch_record *layer = _patch_index[i]; layer; layer = layer->below) {
+            if (strip_code_pointer(layer->value) == pointer) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static bool words_contain(uintptr_t start, uint64_t size, uintptr_t target) {
+    void **words = (void **)start;
+    for (uint64_t i = 0; i < size / sizeof(void *); i++) {
+        if ((uintptr_t)strip_code_pointer(words[i]) == target) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// 零填充部分按页查看，从未写过的页不在内存中，内容全为 0，跳过时也不会把它们读进来
+static bool zero_fill_contains(uintptr_t start, uintptr_t end, uintptr_t target) {
+    uintptr_t page_size = (uintptr_t)getpagesize();
+    uintptr_t page = start & ~(page_size - 1);
+    char residency[64];
+    while (page < end) {
+        size_t pages = (end - page + page_size - 1) / page_size;
+        if (pages > sizeof(residency)) {
+            pages = sizeof(residency);
+        }
+        bool known = mincore((void *)page, pages * page_size, (void *)residency) == 0;
+        for (size_t i = 0; i < pages; i++, page += page_size) {
+            if (known && !residency[i]) {
+                continue;
+            }
+            uintptr_t from = page > start ? page : start;
+            uintptr_t to = page + page_size < end ? page + page_size : end;
+            if (words_contain(from, to - from, target)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+/*
+ * Rechaining makes value forward to found. If found is itself a hook that saved
+ * value as its original, as a fishhook-style library that rebound the slot
+ * after us does, the two would call each other forever. Whether found forwards
+ * to value cannot be known, so this looks for value in the writable segments of
+ * the image containing found, where such a library keeps its originals; of the
+ * zero-fill part of a segment only the pages written so far are read. An image
+ * that has not been scanned, or an address outside any image, counts as
+ * unsafe.
+ */
+static bool may_forward_to(void *found, void *value) {
+    if (is_logged_value(strip_code_pointer(found))) {
+        return true;                                                // 转发给我们自己写入的另一个值
+    }
+    uintptr_t address = (uintptr_t)strip_code_pointer(found);
+    uintptr_t target = (uintptr_t)strip_code_pointer(value);
+    for (const struct image_view *view = _image_views; view; view = view->next) {
+        bool contains = false;
+        for (uint32_t i = 0; i < view->segments_nel && !contains; i++) {
+            contains = address - view->segments[i].start < view->segments[i].size;
+        }
+        if (!contains) {
+            continue;
+        }
+        for (uint32_t i = 0; i < view->segments_nel; i++) {
+            const struct image_segment *segment = &view->segments[i];
+            if (segment->is_writable &&
+                (words_contain(segment->start, segment->file_size, target) ||
+                 zero_fill_contains(segment->start + segment->file_size, segment->start + segment->size, target))) {
+                return true;
+            }
+        }
+        return false;
+    }
+    return true;
+}
+
+// 同一个覆盖值只检查一次；slot 又被改写成别的值时重新检查
+static bool record_may_forward_to(struct patch_record *record, void *found) {
+    if (record->checked_found != found) {
+        record->found_may_forward = may_forward_to(found, record->value);
+        record->checked_found = found;
+    }
+    return record->found_may_forward;
+}
+
+int rebind_symbols_verify(struct rebind_drift drifts[], size_t drifts_nel) {
+    if (!lock_rebindings()) {
+        unlock_rebindings();
+        return -1;
+    }
+    // 索引是连续数组，每个 slot 只需一次读取和比较
+    size_t drifted = 0;
+    for (size_t i = 0; _patch_index && i <= _patch_index_mask; i++) {
+        struct patch_record *record = _patch_index[i];
+        if (!record) {
+            continue;
+        }
+        void *found = read_patch_slot(record);
+        if (found == record->value) {
+            continue;
+        }
+        if (drifted < drifts_nel) {
+            drifts[drifted].slot = record->slot;
+            drifts[drifted].expected = record->value;
+            drifts[drifted].found = found;
+        }
+        drifted++;
+    }
+    unlock_rebindings();
+    return (int)drifted;
+}
+
+int rebind_symbols_rechain(void **slot) {
+    if (!lock_rebindings()) {
+        unlock_rebindings();
+        return -1;
+    }
+    int retval = 0;
+    struct patch_record *record = _patch_index ? find_patch(slot) : NULL;
+    void *found = record ? read_patch_slot(record) : NULL;
+    // 没有 replaced 就无法转发；可能转发回 replacement 的值接回去会形成环，两者都不接
+    if (record && found != record->value && record->replaced && !record_may_forward_to(record, found)) {
+        struct arena scratch = {0};
+        struct patch_update update = { record, record->value, found };
+        if (write_patch_updates(&update, 1, &scratch) == 1) {
+            // 重新写回 replacement，覆盖者的值成为这一层下面的值，replacement 通过 replaced 转发给它
+            record->previous = found;
+            *(record->replaced) = found;
+            retval = 1;
+        } else {
+            retval = -1;
+        }
+        arena_release(&scratch);
+    }
+    unlock_rebindings();
+    return retval;
+}
+
+static void *rebind_async_main(void *arg) {
+    struct rebind_async *async = (struct rebind_async *)arg;
+    if (async->needs_registration) {
+        // 注册时 dyld 会在当前线程上回放所有已加载的镜像，回调各自加锁
+        _registering_async = async;
+        _dyld_register_func_for_add_image(_rebind_symbols_for_image);
+        _registering_async = NULL;
+    } else {
+        uint32_t c = _dyld_image_count();
+        for (uint32_t i = 0; i < c; i++) {
+            const struct mach_header *header = _dyld_get_image_header(i);
+            if (header) {                   // 期间有镜像卸载时下标会越界
+                rebind_async_image(async, header, _dyld_get_image_vmaddr_slide(i));
+            }
+        }
+    }
+    return NULL;
+}
+
+struct rebind_async *rebind_symbols_async(struct rebinding rebindings[],
+                                          size_t rebindings_nel,
+                                          const char *const sync_images[],
+                                          size_t sync_images_nel,
+                                          rebind_image_callback_t image_callback,
+                                          void *context) {
+    struct arena arena = {0};
+    struct rebind_async *async = (struct rebind_async *) arena_alloc(&arena, sizeof(struct rebind_async));
+    if (!async) {
+        return NULL;
+    }
+    async->image_callback = image_callback;
+    async->context = context;
+    
+    pthread_once(&_forget_image_view_once, register_forget_image_view);
+    async->retval = -1;
+    if (lock_rebindings()) {
+        async->retval = prepend_rebindings(&_rebindings_head, &_rebindings_arena, rebindings, rebindings_nel);
+    }
+    if (async->retval == 0) {
+        _rebindings_generation++;
+        async->needs_registration = !_rebindings_head->next;
+    }
+    unlock_rebindings();
+    
+    // 关键镜像在调用线程上立即完成重绑定；dyld 的查询在锁外进行，每个镜像单独加锁
+    uint32_t c = async->retval == 0 && sync_images_nel ? _dyld_image_count() : 0;
+    async->sync_headers = (const struct mach_header **) arena_alloc(&arena, sizeof(struct mach_header *) * (c ? c : 1));
+    for (uint32_t i = 0; async->sync_headers && i < c; i++) {
+        const char *image_name = _dyld_get_image_name(i);
+        const struct mach_header *header = _dyld_get_image_header(i);
+        for (size_t j = 0; image_name && header && j < sync_images_nel; j++) {
+            if (library_matches(image_name, sync_images[j])) {
+                intptr_t slide = _dyld_get_image_vmaddr_slide(i);
+                bool rebound = false;
+                if (lock_rebindings()) {
+                    const struct rebinding_plan *plan = current_rebinding_plan();
+                    if (plan) {
+                        rebind_symbols_for_image(plan, header, slide);
+                        rebound = true;
+                    }
+                }
+                unlock_rebindings();
+                if (rebound && image_callback) {
+                    image_callback(header, slide, context);
+                }
+                async->sync_headers[async->sync_headers_nel++] = header;
+                break;
+            }
+        }
+    }
+    
+    async->arena = arena;
+    if (async->retval == 0) {
+        if (pthread_create(&async->thread, NULL, rebind_async_main, async) == 0) {
+            async->has_thread = true;
+        } else {
+            rebind_async_main(async);       // 无法创建线程时退化为同步执行
+        }
+    }
+    return async;
+}
+
+int rebind_symbols_async_wait(struct rebind_async *async) {
+    if (!async) {
+        return -1;
+    }
+    if (async->has_thread) {
+        pthread_join(async->thread, NULL);
     }
+    int retval = async->retval;
+    struct arena arena = async->arena;      // 先拷出来，handle 本身位于 arena 中
+    arena_release(&arena);
     return retval;
 }
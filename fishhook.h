@@ -54,6 +54,33 @@ struct rebinding {
  * by the process. If rebind_functions is called more than once, the symbols to
  * rebind are added to the existing list of rebindings, and if a given symbol
  * is rebound more than once, the later rebinding will take precedence.
+ *
+ * A name may be qualified with the library it is imported from, e.g.
+ * "close@libSystem.B.dylib" or "objc_msgSend@libobjc.A.dylib". The qualifier
+ * is compared against the install name of each LC_LOAD_DYLIB-style dependency
+ * (either the full path or its last component) and only slots bound through
+ * that library's two-level namespace ordinal are rebound. The qualifier must
+ * name the library the image links directly, not one it re-exports: an app
+ * imports close through /usr/lib/libSystem.B.dylib, so
+ * "close@libsystem_kernel.dylib" matches only images that link
+ * libsystem_kernel themselves. Images linked with a flat namespace never match
+ * a qualified name.
+ *
+ * Names prefixed with "c++:" are matched against the demangled form of C++
+ * symbols instead, e.g. "c++:operator new(unsigned long)" or, with a trailing
+ * '*', every symbol under a prefix such as "c++:mylib::*". Imported names are
+ * demangled once per image, and only if such a rebinding is registered.
+ *
+ * A lazy symbol pointer that has not been bound yet still points at the
+ * image's __stub_helper. For those, the real implementation is looked up with
+ * dlsym in the library the symbol is imported from, once fishhook has released
+ * its lock, and stored through replaced in place of the stub. If the lookup
+ * fails (e.g. a weak import whose library is not loaded), replaced keeps the
+ * stub, and the first call through it binds the symbol lazily.
+ *
+ * Slots rewritten before fork stay rewritten in the child. If another thread
+ * was inside fishhook when fork was called, its state may be half updated in
+ * the child, and every fishhook call there returns -1.
  */
 FISHHOOK_VISIBILITY
 int rebind_symbols(struct rebinding rebindings[], size_t rebindings_nel);
@@ -69,6 +96,178 @@ int rebind_symbols_image(void *header,      // Mach-O 头
                          struct rebinding rebindings[],
                          size_t rebindings_nel);
 
+/*
+ * Points every slot that fishhook rewrote to replacement, and that still holds
+ * it, at new_replacement instead. Rebindings registered with replacement use
+ * new_replacement for images loaded later. Where a later fishhook rebinding
+ * was layered on top of replacement, the log is updated so that restoring it
+ * yields new_replacement, and its replaced pointer is moved over if it still
+ * holds replacement. The replaced pointers of the swapped rebindings are left
+ * as they are. Slots that another library has written over since are not
+ * touched, but rebind_symbols_rechain rechains them to new_replacement from
+ * then on. Returns the number of slots rewritten, or -1 on error.
+ */
+FISHHOOK_VISIBILITY
+int rebind_symbols_swap(void *replacement, void *new_replacement);
+
+/*
+ * Restores every slot that fishhook rewrote to replacement, and that still
+ * holds it, to the value it held before, and unregisters the rebindings to
+ * replacement so images loaded later are left alone. Slots that another
+ * library has written over since are not touched, but are dropped from the log
+ * so rebind_symbols_verify no longer reports them and rebind_symbols_rechain
+ * leaves them alone. Where a later fishhook
+ * rebinding was layered on top of replacement, replacement is taken out of
+ * the chain instead: the slot keeps the later rebinding, which is restored to
+ * the value from before replacement, and its replaced pointer is moved there
+ * if it still holds replacement. Returns the number of slots restored, or -1
+ * on error.
+ */
+FISHHOOK_VISIBILITY
+int rebind_symbols_detach(void *replacement);
+
+/*
+ * A slot that fishhook rewrote and that no longer holds the value written.
+ */
+struct rebind_drift {
+    void **slot;
+    void *expected;     // fishhook 写入的 replacement
+    void *found;        // slot 中现在的值
+};
+
+/*
+ * Checks every slot that fishhook has rewritten and reports those that have
+ * since been written over by someone else, e.g. another hooking library. Up to
+ * drifts_nel of them are stored in drifts. Cheap enough to be called
+ * periodically. Returns the number of slots that had drifted, which may exceed
+ * drifts_nel, or -1 on error.
+ */
+FISHHOOK_VISIBILITY
+int rebind_symbols_verify(struct rebind_drift drifts[], size_t drifts_nel);
+
+/*
+ * Takes back one slot reported by rebind_symbols_verify: the slot is pointed at
+ * the replacement again and the value found in it is stored through that
+ * rebinding's replaced, so that the replacement forwards to the other hook
+ * instead of bypassing it. Note that replaced is shared by every image the
+ * rebinding applies to, so the replacement then also forwards to the other hook
+ * when it is called from any other image. Returns 1 if the slot was rechained,
+ * 0 if it was left alone, or -1 on error.
+ *
+ * Only opt in for slots whose other hook is known to get its original from
+ * somewhere other than the slot. A fishhook-style library that rebound the slot
+ * after us saved our replacement as its original, and rechaining would make
+ * the two call each other forever. fishhook cannot tell whether a hook
+ * forwards back and only guesses: it leaves the slot alone if its rebinding
+ * has no replaced pointer, if the value found is one fishhook wrote itself, if
+ * it lies outside the images fishhook has scanned, or if its image holds the
+ * replacement anywhere in its writable segments. A hook that keeps its
+ * original in heap memory, in thread-local storage or in a register-only
+ * trampoline passes that check and is rechained into a loop all the same. The
+ * guess is made once for each value found in a slot.
+ */
+FISHHOOK_VISIBILITY
+int rebind_symbols_rechain(void **slot);
+
+/*
+ * Called once for every image rebound by rebind_symbols_async, with the mach-o
+ * header and slide of that image.
+ */
+typedef void (*rebind_image_callback_t)(const void *header, intptr_t slide, void *context);
+
+struct rebind_async;
+
+/*
+ * Registers rebindings like rebind_symbols, but only rebinds the images named
+ * in sync_images (full path or last path component) on the calling thread, and
+ * returns before the remaining images are scanned on a background thread.
+ * image_callback, which may be NULL, is called for each rebound image on the
+ * thread that rebound it, after fishhook's internal lock has been released, so
+ * it may call into fishhook. On the background thread it may run inside a dyld
+ * add-image callback and must not load or unload images. Images loaded
+ * later are rebound as usual when dyld adds them. Returns NULL if the handle
+ * could not be allocated; otherwise the handle must be passed to
+ * rebind_symbols_async_wait.
+ */
+FISHHOOK_VISIBILITY
+struct rebind_async *rebind_symbols_async(struct rebinding rebindings[],
+                                          size_t rebindings_nel,
+                                          const char *const sync_images[],
+                                          size_t sync_images_nel,
+                                          rebind_image_callback_t image_callback,
+                                          void *context);
+
+/*
+ * Blocks until every image that was loaded when rebind_symbols_async was called
+ * has been rebound, then frees the handle. Returns the same value as
+ * rebind_symbols would have.
+ */
+FISHHOOK_VISIBILITY
+int rebind_symbols_async_wait(struct rebind_async *async);
+
+/*
+ * Counters describing the work done by fishhook in this process: images whose
+ * symbol tables were walked, symbol pointer slots inspected, slots rewritten,
+ * the time spent scanning images, mprotect calls made to write into read-only
+ * segments and the pages those calls made writable.
+ */
+struct fishhook_stats {
+    uint64_t images_scanned;
+    uint64_t slots_scanned;
+    uint64_t slots_rebound;
+    uint64_t scan_ns;
+    uint64_t mprotect_calls;
+    uint64_t pages_unprotected;
+};
+
+/*
+ * Copies the counters of the calling process into stats.
+ */
+FISHHOOK_VISIBILITY
+void fishhook_get_stats(struct fishhook_stats *stats);
+
+/*
+ * Moves the counters of the calling process into a slot of the named POSIX
+ * shared memory segment, creating it with room for max_processes slots if it
+ * does not exist yet. Counters are only updated with relaxed atomics, so there
+ * is no IPC on the rebinding path. Forked children claim a slot of their own.
+ * Returns 0 on success and -1 if the segment could not be mapped or is full.
+ */
+FISHHOOK_VISIBILITY
+int fishhook_stats_attach_shared(const char *name, uint32_t max_processes);
+
+/*
+ * Sums the counters of every process attached to the named segment into total.
+ * Slots of exited processes are kept until reused, so their counts are
+ * included. Returns the number of slots in use, or -1 if the segment is missing.
+ */
+FISHHOOK_VISIBILITY
+int fishhook_stats_read_shared(const char *name, struct fishhook_stats *total);
+
+#ifdef FISHHOOK_ENABLE_LAUNCH_PREFETCH
+
+/*
+ * Starts recording which ranges of which files the process opens, reads and
+ * maps, by rebinding open, openat, read, pread, mmap and close. If profile_path
+ * holds a profile from an earlier launch, the ranges it lists are first handed
+ * to the kernel as read-ahead advice from a background thread. Call as early
+ * during launch as possible. Returns 0 on success, or -1 if recording is
+ * already in progress or the hooks could not be installed.
+ */
+FISHHOOK_VISIBILITY
+int fishhook_prefetch_begin(const char *profile_path);
+
+/*
+ * Stops recording, removes the hooks and replaces the profile with the ranges
+ * recorded since fishhook_prefetch_begin, merged to whole pages. If nothing
+ * was recorded, the previous profile is kept. Returns 0 on success and -1 if
+ * recording was not in progress or the profile could not be written.
+ */
+FISHHOOK_VISIBILITY
+int fishhook_prefetch_end(void);
+
+#endif
+
 #ifdef __cplusplus
 }
 #endif //__cplusplus
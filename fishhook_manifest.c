@@ -0,0 +1,166 @@
+// Copyright (c) 2013, Facebook, Inc.
+// All rights reserved.
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name Facebook nor the names of its contributors may be used to
+//     endorse or promote products derived from this software without specific
+//     prior written permission.
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/*
+ * Optional constructor that installs hooks before application code runs, so
+ * that calls made by the initializers of images loaded after fishhook are
+ * hooked as well. It reads the manifest named by FISHHOOK_MANIFEST; each line
+ * holds a name as accepted by rebind_symbols, the replacement exported by the
+ * library named by FISHHOOK_HOOK_LIBRARY and, optionally, a void * variable in
+ * that library that receives the original:
+ *
+ *     # name                           replacement   original
+ *     open                             hook_open     orig_open
+ *     close@libSystem.B.dylib          hook_close
+ *
+ * Blank lines and lines starting with '#' are ignored, as are lines whose
+ * replacement or original cannot be found. Nothing happens in setuid or
+ * setgid processes. Built only with FISHHOOK_ENABLE_MANIFEST_LOADER, and uses
+ * nothing but the public fishhook API.
+ */
+#ifdef FISHHOOK_ENABLE_MANIFEST_LOADER
+
+#include "fishhook.h"
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// 读入整个文件并以 '\0' 结尾；rebind_symbols 引用其中的名字，用到时缓冲区不释放
+static char *read_manifest(const char *path, size_t *length) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat st;
+    char *buffer = NULL;
+    if (fstat(fd, &st) == 0 && st.st_size >= 0) {
+        buffer = (char *) malloc((size_t)st.st_size + 1);
+    }
+    size_t used = 0;
+    while (buffer && used < (size_t)st.st_size) {
+        ssize_t n = read(fd, buffer + used, (size_t)st.st_size - used);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;                                                  // 读取过程中文件被截断，按已读到的内容处理
+        }
+        used += (size_t)n;
+    }
+    close(fd);
+    if (buffer) {
+        buffer[used] = '\0';
+        *length = used;
+    }
+    return buffer;
+}
+
+// 切出下一个空白分隔的字段，到行尾时返回 NULL
+static char *next_manifest_field(char **cursor) {
+    char *p = *cursor;
+    while (*p == ' ' || *p == '\t' || *p == '\r') {
+        p++;
+    }
+    if (*p == '\0') {
+        *cursor = p;
+        return NULL;
+    }
+    char *field = p;
+    while (*p != '\0' && *p != ' ' && *p != '\t' && *p != '\r') {
+        p++;
+    }
+    if (*p != '\0') {
+        *p++ = '\0';
+    }
+    *cursor = p;
+    return field;
+}
+
+__attribute__((constructor))
+static void load_rebinding_manifest(void) {
+    const char *manifest_path = getenv("FISHHOOK_MANIFEST");
+    const char *library_path = getenv("FISHHOOK_HOOK_LIBRARY");
+    if (!manifest_path || !library_path || issetugid()) {
+        return;
+    }
+    void *library = dlopen(library_path, RTLD_NOW | RTLD_LOCAL);   // 已预加载时只是取得句柄
+    if (!library) {
+        return;
+    }
+    size_t length = 0;
+    char *manifest = read_manifest(manifest_path, &length);
+    if (!manifest) {
+        return;
+    }
+    size_t capacity = 1;
+    for (size_t i = 0; i < length; i++) {
+        capacity += manifest[i] == '\n';
+    }
+    struct rebinding *rebindings = (struct rebinding *) calloc(capacity, sizeof(struct rebinding));
+    if (!rebindings) {
+        free(manifest);
+        return;
+    }
+    size_t nel = 0;
+    char *line = manifest;
+    while (line) {
+        char *end = strchr(line, '\n');
+        if (end) {
+            *end = '\0';
+        }
+        char *cursor = line;
+        line = end ? end + 1 : NULL;
+        char *name = next_manifest_field(&cursor);
+        if (!name || name[0] == '#') {
+            continue;
+        }
+        char *replacement_name = next_manifest_field(&cursor);
+        char *original_name = replacement_name ? next_manifest_field(&cursor) : NULL;
+        if (!replacement_name || (original_name && next_manifest_field(&cursor))) {
+            continue;                                               // 字段数不对
+        }
+        void *replacement = dlsym(library, replacement_name);
+        void **replaced = original_name ? (void **) dlsym(library, original_name) : NULL;
+        if (!replacement || (original_name && !replaced)) {
+            continue;
+        }
+        rebindings[nel].name = name;
+        rebindings[nel].replacement = replacement;
+        rebindings[nel].replaced = replaced;
+        nel++;
+    }
+    if (nel) {
+        rebind_symbols(rebindings, nel);
+    }
+    free(rebindings);                                               // rebind_symbols 复制了数组，名字仍指向 manifest
+    if (!nel) {
+        free(manifest);
+    }
+}
+
+#endif
@@ -0,0 +1,530 @@
+// Copyright (c) 2013, Facebook, Inc.
+// All rights reserved.
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//   * Neither the name Facebook nor the names of its contributors may be used to
+//     endorse or promote products derived from this software without specific
+//     prior written permission.
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/*
+ * Launch prefetching. Between fishhook_prefetch_begin and fishhook_prefetch_end
+ * open, openat, read, pread, mmap and close are rebound to record which ranges
+ * of which files the process reads. fishhook_prefetch_end merges them to whole
+ * pages and writes them to the profile, one "offset length path" line per
+ * range. The next fishhook_prefetch_begin with the same profile hands those
+ * ranges to the kernel as read-ahead advice from a background thread, so the
+ * page-ins overlap with launch instead of blocking it. Built only with
+ * FISHHOOK_ENABLE_LAUNCH_PREFETCH, and uses nothing but the public fishhook API.
+ */
+#ifdef FISHHOOK_ENABLE_LAUNCH_PREFETCH
+
+#include "fishhook.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#define PREFETCH_PROFILE_HEADER "fishhook-prefetch 1\n"
+#define PREFETCH_MAX_FD 4096                // 更大的描述符不记录
+#define PREFETCH_ACCESS_BLOCK_SIZE 256
+#define PREFETCH_ADVICE_CHUNK (1u << 30)    // F_RDADVISE 的长度是 int
+
+struct prefetch_file {
+    struct prefetch_file *next;
+    uint32_t hash;
+    char path[];
+};
+
+struct prefetch_access {
+    const struct prefetch_file *file;
+    uint64_t offset;
+    uint64_t length;
+};
+
+struct prefetch_access_block {
+    struct prefetch_access_block *next;
+    size_t count;
+    struct prefetch_access entries[PREFETCH_ACCESS_BLOCK_SIZE];
+};
+
+// 以下由 _prefetch_lock 保护；_prefetch_fds 允许在锁外读取，用于快速跳过未记录的描述符
+static pthread_mutex_t _prefetch_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t _prefetch_atfork_once = PTHREAD_ONCE_INIT;
+static bool _prefetch_recording;
+static char *_prefetch_profile_path;
+static struct prefetch_file *_prefetch_files;
+static struct prefetch_access_block *_prefetch_accesses;
+static const struct prefetch_file *_Atomic _prefetch_fds[PREFETCH_MAX_FD];
+
+static __thread bool _prefetch_ignore;      // 预取线程和写 profile 时自己的文件操作不记录
+
+static int (*orig_prefetch_open)(const char *, int, ...);
+static int (*orig_prefetch_openat)(int, const char *, int, ...);
+static ssize_t (*orig_prefetch_read)(int, void *, size_t);
+static ssize_t (*orig_prefetch_pread)(int, void *, size_t, off_t);
+static void *(*orig_prefetch_mmap)(void *, size_t, int, int, int, off_t);
+static int (*orig_prefetch_close)(int);
+
+// fork 时持有锁，子进程中不会留下被其他线程持有的锁
+static void prefetch_atfork_prepare(void) {
+    pthread_mutex_lock(&_prefetch_lock);
+}
+
+static void prefetch_atfork_parent(void) {
+    pthread_mutex_unlock(&_prefetch_lock);
+}
+
+static void prefetch_atfork_child(void) {
+    pthread_mutex_init(&_prefetch_lock, NULL);
+}
+
+static void setup_prefetch_atfork(void) {
+    pthread_atfork(prefetch_atfork_prepare, prefetch_atfork_parent, prefetch_atfork_child);
+}
+
+static const struct prefetch_file *prefetch_file_for_fd(int fd) {
+    if (fd < 0 || fd >= PREFETCH_MAX_FD || _prefetch_ignore) {
+        return NULL;
+    }
+    return atomic_load_explicit(&_prefetch_fds[fd], memory_order_relaxed);
+}
+
+// FNV-1a
+static uint32_t hash_prefetch_path(const char *path, size_t *len) {
+    uint32_t hash = 2166136261u;
+    const char *p = path;
+    for (; *p; p++) {
+        hash = (hash ^ (uint8_t)*p) * 16777619u;
+    }
+    *len = (size_t)(p - path);
+    return hash;
+}
+
+// 调用方持有锁
+static const struct prefetch_file *intern_prefetch_file(const char *path) {
+    size_t len;
+    uint32_t hash = hash_prefetch_path(path, &len);
+    for (struct prefetch_file *file = _prefetch_files; file; file = file->next) {
+        if (file->hash == hash && strcmp(file->path, path) == 0) {
+            return file;
+        }
+    }
+    struct prefetch_file *file = (struct prefetch_file *) malloc(sizeof(struct prefetch_file) + len + 1);
+    if (!file) {
+        return NULL;
+    }
+    memcpy(file->path, path, len + 1);
+    file->hash = hash;
+    file->next = _prefetch_files;
+    _prefetch_files = file;
+    return file;
+}
+
+static void prefetch_note_open(int fd, int dirfd, const char *path) {
+    if (fd < 0 || fd >= PREFETCH_MAX_FD || _prefetch_ignore) {
+        return;
+    }
+#ifdef F_GETPATH
+    char resolved[PATH_MAX];
+    (void)dirfd;
+    if (fcntl(fd, F_GETPATH, resolved) == 0) {
+        path = resolved;                                            // 规范化的绝对路径，相对路径和 openat 都能处理
+    } else {
+        path = NULL;
+    }
+#else
+    (void)dirfd;
+    if (path[0] != '/') {
+        path = NULL;                                                // 相对路径在下次启动时未必指向同一个文件
+    }
+#endif
+    if (path && strchr(path, '\n')) {
+        path = NULL;                                                // profile 按行分隔
+    }
+    pthread_mutex_lock(&_prefetch_lock);
+    if (_prefetch_recording) {
+        atomic_store_explicit(&_prefetch_fds[fd], path ? intern_prefetch_file(path) : NULL, memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&_prefetch_lock);
+}
+
+static void prefetch_note_access(int fd, off_t offset, uint64_t length) {
+    if (offset < 0 || length == 0) {
+        return;
+    }
+    pthread_mutex_lock(&_prefetch_lock);
+    const struct prefetch_file *file = _prefetch_recording ? prefetch_file_for_fd(fd) : NULL;
+    if (file) {
+        if (!_prefetch_accesses || _prefetch_accesses->count == PREFETCH_ACCESS_BLOCK_SIZE) {
+            struct prefetch_access_block *block = (struct prefetch_access_block *) malloc(sizeof(struct prefetch_access_block));
+            if (block) {
+                block->count = 0;
+                block->next = _prefetch_accesses;
+                _prefetch_accesses = block;
+            }
+        }
+        if (_prefetch_accesses && _prefetch_accesses->count < PREFETCH_ACCESS_BLOCK_SIZE) {
+            struct prefetch_access *access = &_prefetch_accesses->entries[_prefetch_accesses->count++];
+            access->file = file;
+            access->offset = (uint64_t)offset;
+            access->length = length;
+        }
+    }
+    pthread_mutex_unlock(&_prefetch_lock);
+}
+
+static int prefetch_open(const char *path, int flags, ...) {
+    int mode = 0;
+    if (flags & O_CREAT) {
+        va_list args;
+        va_start(args, flags);
+        mode = va_arg(args, int);
+        va_end(args);
+    }
+    int fd = orig_prefetch_open(path, flags, mode);
+    prefetch_note_open(fd, AT_FDCWD, path);
+    return fd;
+}
+
+static int prefetch_openat(int dirfd, const char *path, int flags, ...) {
+    int mode = 0;
+    if (flags & O_CREAT) {
+        va_list args;
+        va_start(args, flags);
+        mode = va_arg(args, int);
+        va_end(args);
+    }
+    int fd = orig_prefetch_openat(dirfd, path, flags, mode);
+    prefetch_note_open(fd, dirfd, path);
+    return fd;
+}
+
+static ssize_t prefetch_read(int fd, void *buffer, size_t nbyte) {
+    off_t offset = prefetch_file_for_fd(fd) ? lseek(fd, 0, SEEK_CUR) : -1;   // 不能 seek 的描述符返回 -1
+    ssize_t result = orig_prefetch_read(fd, buffer, nbyte);
+    if (offset >= 0 && result > 0) {
+        prefetch_note_access(fd, offset, (uint64_t)result);
+    }
+    return result;
+}
+
+static ssize_t prefetch_pread(int fd, void *buffer, size_t nbyte, off_t offset) {
+    ssize_t result = orig_prefetch_pread(fd, buffer, nbyte, offset);
+    if (result > 0 && prefetch_file_for_fd(fd)) {
+        prefetch_note_access(fd, offset, (uint64_t)result);
+    }
+    return result;
+}
+
+static void *prefetch_mmap(void *address, size_t length, int protection, int flags, int fd, off_t offset) {
+    void *result = orig_prefetch_mmap(address, length, protection, flags, fd, offset);
+    if (result != MAP_FAILED && !(flags & MAP_ANON) && prefetch_file_for_fd(fd)) {
+        prefetch_note_access(fd, offset, length);
+    }
+    return result;
+}
+
+static int prefetch_close(int fd) {
+    if (fd >= 0 && fd < PREFETCH_MAX_FD) {
+        atomic_store_explicit(&_prefetch_fds[fd], NULL, memory_order_relaxed);    // 描述符随后可能被复用
+    }
+    return orig_prefetch_close(fd);
+}
+
+static void prefetch_advise(int fd, uint64_t offset, uint64_t length) {
+#if defined(F_RDADVISE)
+    while (length) {
+        uint64_t chunk = length < PREFETCH_ADVICE_CHUNK ? length : PREFETCH_ADVICE_CHUNK;
+        struct radvisory advice;
+        advice.ra_offset = (off_t)offset;
+        advice.ra_count = (int)chunk;
+        if (fcntl(fd, F_RDADVISE, &advice) != 0) {
+            return;
+        }
+        offset += chunk;
+        length -= chunk;
+    }
+#elif defined(POSIX_FADV_WILLNEED)
+    posix_fadvise(fd, (off_t)offset, (off_t)length, POSIX_FADV_WILLNEED);
+#else
+    (void)fd;
+    (void)offset;
+    (void)length;
+#endif
+}
+
+// 读入整个文件并以 '\0' 结尾
+static char *read_profile(const char *path, size_t *length) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat st;
+    char *buffer = NULL;
+    if (fstat(fd, &st) == 0 && st.st_size >= 0) {
+        buffer = (char *) malloc((size_t)st.st_size + 1);
+    }
+    size_t used = 0;
+    while (buffer && used < (size_t)st.st_size) {
+        ssize_t n = read(fd, buffer + used, (size_t)st.st_size - used);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;                                                  // 读取过程中文件被截断，按已读到的内容处理
+        }
+        used += (size_t)n;
+    }
+    close(fd);
+    if (buffer) {
+        buffer[used] = '\0';
+        *length = used;
+    }
+    return buffer;
+}
+
+// 预取线程的参数，路径的副本归线程所有，由线程释放
+static void *prefetch_main(void *arg) {
+    char *profile_path = (char *)arg;
+    _prefetch_ignore = true;
+    size_t length = 0;
+    char *profile = read_profile(profile_path, &length);
+    size_t header_len = strlen(PREFETCH_PROFILE_HEADER);
+    if (profile && length >= header_len && memcmp(profile, PREFETCH_PROFILE_HEADER, header_len) == 0) {
+        // 同一文件的范围是连续的，每个文件只打开一次
+        const char *open_path = NULL;
+        int fd = -1;
+        char *line = profile + header_len;
+        char *end;
+        while ((end = strchr(line, '\n')) != NULL) {                // 没有换行的最后一行视为不完整，丢弃
+            *end = '\0';
+            char *cursor;
+            unsigned long long offset = strtoull(line, &cursor, 10);
+            unsigned long long range_length = cursor != line ? strtoull(cursor, &cursor, 10) : 0;
+            if (range_length && *cursor == ' ') {
+                const char *path = cursor + 1;
+                if (!open_path || strcmp(open_path, path) != 0) {
+                    if (fd >= 0) {
+                        close(fd);
+                    }
+                    fd = open(path, O_RDONLY | O_CLOEXEC);
+                    open_path = path;
+                }
+                if (fd >= 0) {
+                    prefetch_advise(fd, offset, range_length);
+                }
+            }
+            line = end + 1;
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+    free(profile);
+    free(profile_path);
+    return NULL;
+}
+
+static int compare_prefetch_accesses(const void *a, const void *b) {
+    const struct prefetch_access *x = (const struct prefetch_access *)a;
+    const struct prefetch_access *y = (const struct prefetch_access *)b;
+    if (x->file != y->file) {
+        return (uintptr_t)x->file < (uintptr_t)y->file ? -1 : 1;
+    }
+    return x->offset < y->offset ? -1 : x->offset > y->offset;
+}
+
+static bool write_all(int fd, const char *buffer, size_t length) {
+    while (length) {
+        ssize_t n = write(fd, buffer, length);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        buffer += n;
+        length -= (size_t)n;
+    }
+    return true;
+}
+
+// 调用方持有锁，且记录已经停止
+static int write_prefetch_profile(void) {
+    size_t count = 0;
+    for (struct prefetch_access_block *block = _prefetch_accesses; block; block = block->next) {
+        count += block->count;
+    }
+    if (!count) {
+        return 0;                                                   // 什么都没记录到时保留上次的 profile
+    }
+    struct prefetch_access *accesses = (struct prefetch_access *) malloc(sizeof(struct prefetch_access) * count);
+    size_t tmp_len = strlen(_prefetch_profile_path) + 32;
+    char *tmp_path = (char *) malloc(tmp_len);
+    if (!accesses || !tmp_path) {
+        free(accesses);
+        free(tmp_path);
+        return -1;
+    }
+    size_t i = 0;
+    for (struct prefetch_access_block *block = _prefetch_accesses; block; block = block->next) {
+        memcpy(&accesses[i], block->entries, sizeof(struct prefetch_access) * block->count);
+        i += block->count;
+    }
+    qsort(accesses, count, sizeof(struct prefetch_access), compare_prefetch_accesses);
+    
+    // 写到临时文件再 rename，下次启动不会读到写了一半的 profile
+    snprintf(tmp_path, tmp_len, "%s.%d.tmp", _prefetch_profile_path, (int)getpid());
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        free(accesses);
+        free(tmp_path);
+        return -1;
+    }
+    bool ok = write_all(fd, PREFETCH_PROFILE_HEADER, strlen(PREFETCH_PROFILE_HEADER));
+    uint64_t page_mask = (uint64_t)getpagesize() - 1;
+    for (i = 0; i < count && ok; ) {
+        // 按页对齐后合并同一文件中重叠或相邻的范围
+        const struct prefetch_file *file = accesses[i].file;
+        uint64_t start = accesses[i].offset & ~page_mask;
+        uint64_t end = (accesses[i].offset + accesses[i].length + page_mask) & ~page_mask;
+        for (i++; i < count && accesses[i].file == file && (accesses[i].offset & ~page_mask) <= end; i++) {
+            uint64_t next_end = (accesses[i].offset + accesses[i].length + page_mask) & ~page_mask;
+            if (next_end > end) {
+                end = next_end;
+            }
+        }
+        char line[64];
+        int len = snprintf(line, sizeof(line), "%llu %llu ", (unsigned long long)start, (unsigned long long)(end - start));
+        ok = write_all(fd, line, (size_t)len) &&
+             write_all(fd, file->path, strlen(file->path)) &&
+             write_all(fd, "\n", 1);
+    }
+    ok = close(fd) == 0 && ok;
+    if (!ok || rename(tmp_path, _prefetch_profile_path) != 0) {
+        unlink(tmp_path);
+        ok = false;
+    }
+    free(accesses);
+    free(tmp_path);
+    return ok ? 0 : -1;
+}
+
+static void *const _prefetch_replacements[] = {
+    (void *)prefetch_open, (void *)prefetch_openat, (void *)prefetch_read,
+    (void *)prefetch_pread, (void *)prefetch_mmap, (void *)prefetch_close,
+};
+
+// 调用方持有锁
+static void reset_prefetch_state(void) {
+    _prefetch_recording = false;
+    for (int fd = 0; fd < PREFETCH_MAX_FD; fd++) {
+        atomic_store_explicit(&_prefetch_fds[fd], NULL, memory_order_relaxed);
+    }
+    while (_prefetch_files) {
+        struct prefetch_file *next = _prefetch_files->next;
+        free(_prefetch_files);
+        _prefetch_files = next;
+    }
+    while (_prefetch_accesses) {
+        struct prefetch_access_block *next = _prefetch_accesses->next;
+        free(_prefetch_accesses);
+        _prefetch_accesses = next;
+    }
+    free(_prefetch_profile_path);
+    _prefetch_profile_path = NULL;
+}
+
+int fishhook_prefetch_begin(const char *profile_path) {
+    pthread_once(&_prefetch_atfork_once, setup_prefetch_atfork);
+    pthread_mutex_lock(&_prefetch_lock);
+    if (_prefetch_recording) {
+        pthread_mutex_unlock(&_prefetch_lock);
+        return -1;
+    }
+    _prefetch_profile_path = strdup(profile_path);
+    if (!_prefetch_profile_path) {
+        pthread_mutex_unlock(&_prefetch_lock);
+        return -1;
+    }
+    _prefetch_recording = true;
+    pthread_mutex_unlock(&_prefetch_lock);
+    
+    // 先按上次的 profile 在后台预取，失败只是没有加速
+    char *thread_path = strdup(profile_path);
+    pthread_t thread;
+    if (thread_path) {
+        if (pthread_create(&thread, NULL, prefetch_main, thread_path) == 0) {
+            pthread_detach(thread);
+        } else {
+            free(thread_path);
+        }
+    }
+    
+    struct rebinding rebindings[] = {
+        {"open", _prefetch_replacements[0], (void **)&orig_prefetch_open},
+        {"openat", _prefetch_replacements[1], (void **)&orig_prefetch_openat},
+        {"read", _prefetch_replacements[2], (void **)&orig_prefetch_read},
+        {"pread", _prefetch_replacements[3], (void **)&orig_prefetch_pread},
+        {"mmap", _prefetch_replacements[4], (void **)&orig_prefetch_mmap},
+        {"close", _prefetch_replacements[5], (void **)&orig_prefetch_close},
+    };
+    if (rebind_symbols(rebindings, sizeof(rebindings) / sizeof(rebindings[0])) != 0) {
+        pthread_mutex_lock(&_prefetch_lock);
+        reset_prefetch_state();
+        pthread_mutex_unlock(&_prefetch_lock);
+        return -1;
+    }
+    return 0;
+}
+
+int fishhook_prefetch_end(void) {
+    pthread_mutex_lock(&_prefetch_lock);
+    if (!_prefetch_recording) {
+        pthread_mutex_unlock(&_prefetch_lock);
+        return -1;
+    }
+    _prefetch_recording = false;                                    // 之后进入包装函数的调用不再记录
+    pthread_mutex_unlock(&_prefetch_lock);
+    
+    for (size_t i = 0; i < sizeof(_prefetch_replacements) / sizeof(_prefetch_replacements[0]); i++) {
+        rebind_symbols_detach(_prefetch_replacements[i]);
+    }
+    
+    _prefetch_ignore = true;                                        // 被别人覆盖而未能还原的 slot 仍会走到包装函数
+    pthread_mutex_lock(&_prefetch_lock);
+    int retval = write_prefetch_profile();
+    reset_prefetch_state();
+    pthread_mutex_unlock(&_prefetch_lock);
+    _prefetch_ignore = false;
+    return retval;
+}
+
+#endif
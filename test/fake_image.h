@@ -0,0 +1,189 @@
+/*
+ * Builds small in-memory 64-bit Mach-O images for the fixture tests. Each image
+ * is laid out with vmaddr == file offset and loaded at its own address, so its
+ * slide is the address of the buffer:
+ *
+ *   page 0   header and load commands
+ *   page 1   the data segment holding one symbol pointer section
+ *   page 2-3 __LINKEDIT: symbols at +0, strings at +1024, indirect symbols at
+ *            page 3, bind opcodes at page 3 + 512 and lazy binds at + 1536
+ *
+ * Images are cached by fishhook per header, so every test case builds into a
+ * buffer of its own.
+ */
+#ifndef FISHHOOK_TEST_FAKE_IMAGE_H
+#define FISHHOOK_TEST_FAKE_IMAGE_H
+
+#include <stdint.h>
+#include <string.h>
+#include <mach-o/loader.h>
+#include <mach-o/nlist.h>
+
+#define FAKE_PAGE 4096
+#define FAKE_SYMBOLS_MAX 60             // 符号表与字符串表之间只有 1024 字节
+#define FAKE_BIND_OFFSET (3 * FAKE_PAGE + 512)
+#define FAKE_LAZY_BIND_OFFSET (3 * FAKE_PAGE + 1536)
+
+struct fake_image {
+    uint8_t bytes[4 * FAKE_PAGE];
+} __attribute__((aligned(FAKE_PAGE)));
+
+struct fake_symbol {
+    const char *name;                   // 带前导 '_'
+    int library_ordinal;
+};
+
+static inline struct mach_header_64 *fake_header(struct fake_image *image) {
+    return (struct mach_header_64 *)image->bytes;
+}
+
+static inline intptr_t fake_slide(struct fake_image *image) {
+    return (intptr_t)image->bytes;
+}
+
+static inline void **fake_slots(struct fake_image *image) {
+    return (void **)(image->bytes + FAKE_PAGE);
+}
+
+static inline struct load_command *fake_find_command(struct fake_image *image, uint32_t cmd) {
+    struct mach_header_64 *header = fake_header(image);
+    uint8_t *cursor = image->bytes + sizeof(*header);
+    for (uint32_t i = 0; i < header->ncmds; i++) {
+        struct load_command *command = (struct load_command *)cursor;
+        if (command->cmd == cmd) {
+            return command;
+        }
+        cursor += command->cmdsize;
+    }
+    return NULL;
+}
+
+static inline void *fake_append_command(struct fake_image *image, uint32_t cmdsize) {
+    struct mach_header_64 *header = fake_header(image);
+    void *command = image->bytes + sizeof(*header) + header->sizeofcmds;
+    memset(command, 0, cmdsize);
+    header->ncmds++;
+    header->sizeofcmds += cmdsize;
+    return command;
+}
+
+// 第一个段里是 section_type 类型的符号指针 section，第 i 个 slot 对应第 i 个符号，初始值为 0x1000 + i
+static inline void **fake_image_build(struct fake_image *image,
+                                      const struct fake_symbol *symbols,
+                                      int count,
+                                      const char *const *dylibs,
+                                      int dylib_count,
+                                      const char *segname,
+                                      uint32_t section_type) {
+    memset(image, 0, sizeof(*image));
+    fake_header(image)->magic = MH_MAGIC_64;
+    
+    struct segment_command_64 *data = (struct segment_command_64 *)fake_append_command(image, sizeof(struct segment_command_64) + sizeof(struct section_64));
+    data->cmd = LC_SEGMENT_64;
+    data->cmdsize = sizeof(struct segment_command_64) + sizeof(struct section_64);
+    strncpy(data->segname, segname, sizeof(data->segname));
+    data->vmaddr = FAKE_PAGE;
+    data->vmsize = FAKE_PAGE;
+    data->fileoff = FAKE_PAGE;
+    data->filesize = FAKE_PAGE;
+    data->maxprot = VM_PROT_READ | VM_PROT_WRITE;
+    data->initprot = VM_PROT_READ | VM_PROT_WRITE;
+    data->nsects = 1;
+    struct section_64 *section = (struct section_64 *)(data + 1);
+    strncpy(section->sectname, section_type == S_LAZY_SYMBOL_POINTERS ? "__la_symbol_ptr" : "__got", sizeof(section->sectname));
+    strncpy(section->segname, segname, sizeof(section->segname));
+    section->addr = FAKE_PAGE;
+    section->size = (uint64_t)count * sizeof(void *);
+    section->flags = section_type;
+    
+    struct segment_command_64 *linkedit = (struct segment_command_64 *)fake_append_command(image, sizeof(struct segment_command_64));
+    linkedit->cmd = LC_SEGMENT_64;
+    linkedit->cmdsize = sizeof(struct segment_command_64);
+    strncpy(linkedit->segname, SEG_LINKEDIT, sizeof(linkedit->segname));
+    linkedit->vmaddr = 2 * FAKE_PAGE;
+    linkedit->vmsize = 2 * FAKE_PAGE;
+    linkedit->fileoff = 2 * FAKE_PAGE;
+    linkedit->filesize = 2 * FAKE_PAGE;
+    linkedit->maxprot = VM_PROT_READ;
+    linkedit->initprot = VM_PROT_READ;
+    
+    struct nlist_64 *symtab = (struct nlist_64 *)(image->bytes + 2 * FAKE_PAGE);
+    char *strtab = (char *)(image->bytes + 2 * FAKE_PAGE + 1024);
+    uint32_t *indirect = (uint32_t *)(image->bytes + 3 * FAKE_PAGE);
+    uint32_t strsize = 1;
+    for (int i = 0; i < count && i < FAKE_SYMBOLS_MAX; i++) {
+        symtab[i].n_un.n_strx = strsize;
+        symtab[i].n_type = N_EXT;
+        SET_LIBRARY_ORDINAL(symtab[i].n_desc, symbols[i].library_ordinal);
+        strcpy(strtab + strsize, symbols[i].name);
+        strsize += (uint32_t)strlen(symbols[i].name) + 1;
+        indirect[i] = (uint32_t)i;
+    }
+    
+    struct symtab_command *symtab_cmd = (struct symtab_command *)fake_append_command(image, sizeof(struct symtab_command));
+    symtab_cmd->cmd = LC_SYMTAB;
+    symtab_cmd->cmdsize = sizeof(struct symtab_command);
+    symtab_cmd->symoff = 2 * FAKE_PAGE;
+    symtab_cmd->nsyms = (uint32_t)count;
+    symtab_cmd->stroff = 2 * FAKE_PAGE + 1024;
+    symtab_cmd->strsize = strsize;
+    
+    struct dysymtab_command *dysymtab_cmd = (struct dysymtab_command *)fake_append_command(image, sizeof(struct dysymtab_command));
+    dysymtab_cmd->cmd = LC_DYSYMTAB;
+    dysymtab_cmd->cmdsize = sizeof(struct dysymtab_command);
+    dysymtab_cmd->nundefsym = (uint32_t)count;
+    dysymtab_cmd->indirectsymoff = 3 * FAKE_PAGE;
+    dysymtab_cmd->nindirectsyms = (uint32_t)count;
+    
+    for (int i = 0; i < dylib_count; i++) {
+        uint32_t cmdsize = (uint32_t)((sizeof(struct dylib_command) + strlen(dylibs[i]) + 1 + 7) & ~(size_t)7);
+        struct dylib_command *dylib_cmd = (struct dylib_command *)fake_append_command(image, cmdsize);
+        dylib_cmd->cmd = LC_LOAD_DYLIB;
+        dylib_cmd->cmdsize = cmdsize;
+        dylib_cmd->dylib.name.offset = sizeof(struct dylib_command);
+        strcpy((char *)(dylib_cmd + 1), dylibs[i]);
+    }
+    
+    void **slots = fake_slots(image);
+    for (int i = 0; i < count; i++) {
+        slots[i] = (void *)(uintptr_t)(0x1000 + i);
+    }
+    return slots;
+}
+
+// 去掉间接符号表，改由 LC_DYLD_INFO_ONLY 的绑定操作码描述导入；流写在 __LINKEDIT 中的固定位置
+static inline void fake_image_use_bind_opcodes(struct fake_image *image,
+                                               const uint8_t *bind, size_t bind_size,
+                                               const uint8_t *lazy_bind, size_t lazy_bind_size) {
+    ((struct dysymtab_command *)fake_find_command(image, LC_DYSYMTAB))->nindirectsyms = 0;
+    struct dyld_info_command *info = (struct dyld_info_command *)fake_append_command(image, sizeof(struct dyld_info_command));
+    info->cmd = LC_DYLD_INFO_ONLY;
+    info->cmdsize = sizeof(struct dyld_info_command);
+    memcpy(image->bytes + FAKE_BIND_OFFSET, bind, bind_size);
+    info->bind_off = FAKE_BIND_OFFSET;
+    info->bind_size = (uint32_t)bind_size;
+    memcpy(image->bytes + FAKE_LAZY_BIND_OFFSET, lazy_bind, lazy_bind_size);
+    info->lazy_bind_off = FAKE_LAZY_BIND_OFFSET;
+    info->lazy_bind_size = (uint32_t)lazy_bind_size;
+}
+
+// __TEXT 段与 __LINKEDIT 共用第 2 页，其中前 64 字节是 __stub_helper
+static inline void *fake_image_add_stub_helper(struct fake_image *image) {
+    struct segment_command_64 *text = (struct segment_command_64 *)fake_append_command(image, sizeof(struct segment_command_64) + sizeof(struct section_64));
+    text->cmd = LC_SEGMENT_64;
+    text->cmdsize = sizeof(struct segment_command_64) + sizeof(struct section_64);
+    strncpy(text->segname, SEG_TEXT, sizeof(text->segname));
+    text->vmaddr = 2 * FAKE_PAGE;
+    text->vmsize = FAKE_PAGE;
+    text->maxprot = VM_PROT_READ | VM_PROT_EXECUTE;
+    text->initprot = VM_PROT_READ | VM_PROT_EXECUTE;
+    text->nsects = 1;
+    struct section_64 *section = (struct section_64 *)(text + 1);
+    strncpy(section->sectname, "__stub_helper", sizeof(section->sectname));
+    strncpy(section->segname, SEG_TEXT, sizeof(section->segname));
+    section->addr = 2 * FAKE_PAGE;
+    section->size = 64;
+    return image->bytes + 2 * FAKE_PAGE;
+}
+
+#endif
@@ -0,0 +1,199 @@
+/*
+ * Linux implementations of the few Mach and dyld calls fishhook.c makes, for
+ * the fixture tests. vm_region reports the real protection from
+ * /proc/self/maps so that fishhook's write windows restore what they found.
+ */
+#include "dyld_stub.h"
+
+#include <dlfcn.h>
+#include <mach/mach.h>
+#include <mach-o/dyld.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#define STUB_MAX_IMAGES 64
+#define STUB_MAX_CALLBACKS 16
+
+typedef void (*stub_image_callback_t)(const struct mach_header *mh, intptr_t vmaddr_slide);
+
+struct stub_image {
+    const struct mach_header *header;
+    intptr_t slide;
+    const char *name;
+};
+
+static pthread_mutex_t _loader_lock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+static struct stub_image _images[STUB_MAX_IMAGES];
+static uint32_t _image_count;
+static stub_image_callback_t _add_callbacks[STUB_MAX_CALLBACKS];
+static uint32_t _add_callback_count;
+static stub_image_callback_t _remove_callbacks[STUB_MAX_CALLBACKS];
+static uint32_t _remove_callback_count;
+static void (*_observer)(const char *function);
+
+// 每个 dyld 函数入口处调用，在取加载锁之前
+static void observe(const char *function) {
+    if (_observer) {
+        _observer(function);
+    }
+}
+
+void stub_dyld_set_observer(void (*observer)(const char *function)) {
+    _observer = observer;
+}
+
+void stub_dyld_lock(void) {
+    pthread_mutex_lock(&_loader_lock);
+}
+
+void stub_dyld_unlock(void) {
+    pthread_mutex_unlock(&_loader_lock);
+}
+
+void stub_dyld_reset(void) {
+    stub_dyld_lock();
+    _image_count = 0;
+    _add_callback_count = 0;
+    _remove_callback_count = 0;
+    stub_dyld_unlock();
+}
+
+void stub_dyld_add_image(const struct mach_header *header, intptr_t slide, const char *name) {
+    stub_dyld_lock();
+    if (_image_count < STUB_MAX_IMAGES) {
+        _images[_image_count++] = (struct stub_image){ header, slide, name };
+        for (uint32_t i = 0; i < _add_callback_count; i++) {
+            _add_callbacks[i](header, slide);
+        }
+    }
+    stub_dyld_unlock();
+}
+
+void stub_dyld_remove_image(const struct mach_header *header) {
+    stub_dyld_lock();
+    for (uint32_t i = 0; i < _image_count; i++) {
+        if (_images[i].header == header) {
+            for (uint32_t j = 0; j < _remove_callback_count; j++) {
+                _remove_callbacks[j](header, _images[i].slide);
+            }
+            memmove(&_images[i], &_images[i + 1], sizeof(struct stub_image) * (_image_count - i - 1));
+            _image_count--;
+            break;
+        }
+    }
+    stub_dyld_unlock();
+}
+
+// 与 dyld 相同，查询镜像列表也要取加载锁
+uint32_t _dyld_image_count(void) {
+    observe(__func__);
+    stub_dyld_lock();
+    uint32_t count = _image_count;
+    stub_dyld_unlock();
+    return count;
+}
+
+const struct mach_header *_dyld_get_image_header(uint32_t image_index) {
+    observe(__func__);
+    stub_dyld_lock();
+    const struct mach_header *header = image_index < _image_count ? _images[image_index].header : NULL;
+    stub_dyld_unlock();
+    return header;
+}
+
+intptr_t _dyld_get_image_vmaddr_slide(uint32_t image_index) {
+    observe(__func__);
+    stub_dyld_lock();
+    intptr_t slide = image_index < _image_count ? _images[image_index].slide : 0;
+    stub_dyld_unlock();
+    return slide;
+}
+
+const char *_dyld_get_image_name(uint32_t image_index) {
+    observe(__func__);
+    stub_dyld_lock();
+    const char *name = image_index < _image_count ? _images[image_index].name : NULL;
+    stub_dyld_unlock();
+    return name;
+}
+
+// 替换 libc 的 dladdr，查到的信息仍来自真正的实现
+int dladdr(const void *address, Dl_info *info) {
+    static int (*next_dladdr)(const void *, Dl_info *);
+    observe(__func__);
+    if (!next_dladdr) {
+        next_dladdr = (int (*)(const void *, Dl_info *))dlsym(RTLD_NEXT, "dladdr");
+    }
+    stub_dyld_lock();
+    int found = next_dladdr(address, info);
+    stub_dyld_unlock();
+    return found;
+}
+
+// 与 dyld 相同：注册时在加载锁内对已加载的镜像回放一遍
+void _dyld_register_func_for_add_image(stub_image_callback_t func) {
+    observe(__func__);
+    stub_dyld_lock();
+    if (_add_callback_count < STUB_MAX_CALLBACKS) {
+        _add_callbacks[_add_callback_count++] = func;
+        for (uint32_t i = 0; i < _image_count; i++) {
+            func(_images[i].header, _images[i].slide);
+        }
+    }
+    stub_dyld_unlock();
+}
+
+void _dyld_register_func_for_remove_image(stub_image_callback_t func) {
+    observe(__func__);
+    stub_dyld_lock();
+    if (_remove_callback_count < STUB_MAX_CALLBACKS) {
+        _remove_callbacks[_remove_callback_count++] = func;
+    }
+    stub_dyld_unlock();
+}
+
+uint32_t stub_dyld_add_callback_count(void) {
+    return _add_callback_count;
+}
+
+uint32_t stub_dyld_remove_callback_count(void) {
+    return _remove_callback_count;
+}
+
+mach_port_t mach_task_self(void) {
+    return 0;
+}
+
+static kern_return_t region_protection(vm_address_t address, vm_prot_t *protection) {
+    FILE *maps = fopen("/proc/self/maps", "r");
+    if (!maps) {
+        return KERN_INVALID_ADDRESS;
+    }
+    kern_return_t result = KERN_INVALID_ADDRESS;
+    unsigned long start, end;
+    char perms[8];
+    while (fscanf(maps, "%lx-%lx %7s%*[^\n]", &start, &end, perms) == 3) {
+        if (address >= start && address < end) {
+            *protection = (perms[0] == 'r' ? VM_PROT_READ : 0) |
+                          (perms[1] == 'w' ? VM_PROT_WRITE : 0) |
+                          (perms[2] == 'x' ? VM_PROT_EXECUTE : 0);
+            result = KERN_SUCCESS;
+            break;
+        }
+    }
+    fclose(maps);
+    return result;
+}
+
+kern_return_t vm_region(mach_port_t task, vm_address_t *address, vm_size_t *size, int flavor,
+                        vm_region_info_t info, mach_msg_type_number_t *count, memory_object_name_t *object) {
+    (void)task; (void)size; (void)flavor; (void)count; (void)object;
+    return region_protection(*address, &((vm_region_basic_info_data_t *)info)->protection);
+}
+
+kern_return_t vm_region_64(mach_port_t task, vm_address_t *address, vm_size_t *size, int flavor,
+                           vm_region_info_64_t info, mach_msg_type_number_t *count, memory_object_name_t *object) {
+    (void)task; (void)size; (void)flavor; (void)count; (void)object;
+    return region_protection(*address, &((vm_region_basic_info_data_64_t *)info)->protection);
+}
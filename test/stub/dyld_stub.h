@@ -0,0 +1,29 @@
+/*
+ * Test-only controls for the dyld stand-in in dyld_stub.c. Images are added and
+ * removed explicitly; the add and remove callbacks run under a recursive
+ * "loader lock", as they do inside dyld, so tests can check that fishhook never
+ * waits for that lock while holding its own.
+ */
+#ifndef FISHHOOK_TEST_STUB_DYLD_STUB_H
+#define FISHHOOK_TEST_STUB_DYLD_STUB_H
+
+#include <stdint.h>
+#include <mach-o/loader.h>
+
+// 加入镜像并在加载锁内通知已注册的 add-image 回调
+void stub_dyld_add_image(const struct mach_header *header, intptr_t slide, const char *name);
+// 在加载锁内通知 remove-image 回调后移除镜像
+void stub_dyld_remove_image(const struct mach_header *header);
+// 模拟其他线程正在 dlopen：持有加载锁
+void stub_dyld_lock(void);
+void stub_dyld_unlock(void);
+// 每次调用 dyld 函数时先调用 observer，传入函数名；NULL 取消
+void stub_dyld_set_observer(void (*observer)(const char *function));
+// 已注册的 add-image 回调个数
+uint32_t stub_dyld_add_callback_count(void);
+// 已注册的 remove-image 回调个数
+uint32_t stub_dyld_remove_callback_count(void);
+// 清空镜像列表和已注册的回调
+void stub_dyld_reset(void);
+
+#endif
@@ -0,0 +1,19 @@
+/*
+ * Minimal stand-in for <mach-o/dyld.h> for the Linux fixture tests. The
+ * functions are implemented in dyld_stub.c over an image list that the tests
+ * fill in themselves.
+ */
+#ifndef FISHHOOK_TEST_STUB_DYLD_H
+#define FISHHOOK_TEST_STUB_DYLD_H
+
+#include <stdint.h>
+#include <mach-o/loader.h>
+
+uint32_t _dyld_image_count(void);
+const struct mach_header *_dyld_get_image_header(uint32_t image_index);
+intptr_t _dyld_get_image_vmaddr_slide(uint32_t image_index);
+const char *_dyld_get_image_name(uint32_t image_index);
+void _dyld_register_func_for_add_image(void (*func)(const struct mach_header *mh, intptr_t vmaddr_slide));
+void _dyld_register_func_for_remove_image(void (*func)(const struct mach_header *mh, intptr_t vmaddr_slide));
+
+#endif
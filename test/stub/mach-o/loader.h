@@ -0,0 +1,224 @@
+/*
+ * Minimal stand-in for <mach-o/loader.h> for the Linux fixture tests: the load
+ * commands, section types and bind opcodes that fishhook.c reads.
+ */
+#ifndef FISHHOOK_TEST_STUB_LOADER_H
+#define FISHHOOK_TEST_STUB_LOADER_H
+
+#include <stdint.h>
+#include <mach/mach.h>
+
+struct mach_header {
+    uint32_t magic;
+    uint32_t cputype;
+    uint32_t cpusubtype;
+    uint32_t filetype;
+    uint32_t ncmds;
+    uint32_t sizeofcmds;
+    uint32_t flags;
+};
+
+struct mach_header_64 {
+    uint32_t magic;
+    uint32_t cputype;
+    uint32_t cpusubtype;
+    uint32_t filetype;
+    uint32_t ncmds;
+    uint32_t sizeofcmds;
+    uint32_t flags;
+    uint32_t reserved;
+};
+
+#define MH_MAGIC    0xfeedface
+#define MH_MAGIC_64 0xfeedfacf
+#define MH_EXECUTE  0x2
+#define MH_DYLIB    0x6
+
+struct load_command {
+    uint32_t cmd;
+    uint32_t cmdsize;
+};
+
+#define LC_REQ_DYLD          0x80000000
+#define LC_SEGMENT           0x1
+#define LC_SYMTAB            0x2
+#define LC_DYSYMTAB          0xb
+#define LC_LOAD_DYLIB        0xc
+#define LC_ID_DYLIB          0xd
+#define LC_LOAD_WEAK_DYLIB   (0x18 | LC_REQ_DYLD)
+#define LC_SEGMENT_64        0x19
+#define LC_REEXPORT_DYLIB    (0x1f | LC_REQ_DYLD)
+#define LC_LAZY_LOAD_DYLIB   0x20
+#define LC_DYLD_INFO         0x22
+#define LC_DYLD_INFO_ONLY    (0x22 | LC_REQ_DYLD)
+#define LC_LOAD_UPWARD_DYLIB (0x23 | LC_REQ_DYLD)
+
+struct segment_command {
+    uint32_t cmd;
+    uint32_t cmdsize;
+    char segname[16];
+    uint32_t vmaddr;
+    uint32_t vmsize;
+    uint32_t fileoff;
+    uint32_t filesize;
+    vm_prot_t maxprot;
+    vm_prot_t initprot;
+    uint32_t nsects;
+    uint32_t flags;
+};
+
+struct segment_command_64 {
+    uint32_t cmd;
+    uint32_t cmdsize;
+    char segname[16];
+    uint64_t vmaddr;
+    uint64_t vmsize;
+    uint64_t fileoff;
+    uint64_t filesize;
+    vm_prot_t maxprot;
+    vm_prot_t initprot;
+    uint32_t nsects;
+    uint32_t flags;
+};
+
+#define SG_READ_ONLY 0x10
+
+struct section {
+    char sectname[16];
+    char segname[16];
+    uint32_t addr;
+    uint32_t size;
+    uint32_t offset;
+    uint32_t align;
+    uint32_t reloff;
+    uint32_t nreloc;
+    uint32_t flags;
+    uint32_t reserved1;
+    uint32_t reserved2;
+};
+
+struct section_64 {
+    char sectname[16];
+    char segname[16];
+    uint64_t addr;
+    uint64_t size;
+    uint32_t offset;
+    uint32_t align;
+    uint32_t reloff;
+    uint32_t nreloc;
+    uint32_t flags;
+    uint32_t reserved1;
+    uint32_t reserved2;
+    uint32_t reserved3;
+};
+
+#define SECTION_TYPE                 0x000000ff
+#define S_REGULAR                    0x0
+#define S_ZEROFILL                   0x1
+#define S_NON_LAZY_SYMBOL_POINTERS   0x6
+#define S_LAZY_SYMBOL_POINTERS       0x7
+#define S_SYMBOL_STUBS               0x8
+#define S_LAZY_DYLIB_SYMBOL_POINTERS 0x10
+#define S_GB_ZEROFILL                0xc
+#define S_THREAD_LOCAL_ZEROFILL      0x12
+
+#define SEG_TEXT     "__TEXT"
+#define SEG_DATA     "__DATA"
+#define SEG_LINKEDIT "__LINKEDIT"
+
+#define INDIRECT_SYMBOL_LOCAL 0x80000000
+#define INDIRECT_SYMBOL_ABS   0x40000000
+
+struct symtab_command {
+    uint32_t cmd;
+    uint32_t cmdsize;
+    uint32_t symoff;
+    uint32_t nsyms;
+    uint32_t stroff;
+    uint32_t strsize;
+};
+
+struct dysymtab_command {
+    uint32_t cmd;
+    uint32_t cmdsize;
+    uint32_t ilocalsym;
+    uint32_t nlocalsym;
+    uint32_t iextdefsym;
+    uint32_t nextdefsym;
+    uint32_t iundefsym;
+    uint32_t nundefsym;
+    uint32_t tocoff;
+    uint32_t ntoc;
+    uint32_t modtaboff;
+    uint32_t nmodtab;
+    uint32_t extrefsymoff;
+    uint32_t nextrefsyms;
+    uint32_t indirectsymoff;
+    uint32_t nindirectsyms;
+    uint32_t extreloff;
+    uint32_t nextrel;
+    uint32_t locreloff;
+    uint32_t nlocrel;
+};
+
+union lc_str {
+    uint32_t offset;
+};
+
+struct dylib {
+    union lc_str name;
+    uint32_t timestamp;
+    uint32_t current_version;
+    uint32_t compatibility_version;
+};
+
+struct dylib_command {
+    uint32_t cmd;
+    uint32_t cmdsize;
+    struct dylib dylib;
+};
+
+struct dyld_info_command {
+    uint32_t cmd;
+    uint32_t cmdsize;
+    uint32_t rebase_off;
+    uint32_t rebase_size;
+    uint32_t bind_off;
+    uint32_t bind_size;
+    uint32_t weak_bind_off;
+    uint32_t weak_bind_size;
+    uint32_t lazy_bind_off;
+    uint32_t lazy_bind_size;
+    uint32_t export_off;
+    uint32_t export_size;
+};
+
+#define BIND_TYPE_POINTER                           1
+#define BIND_TYPE_TEXT_ABSOLUTE32                   2
+#define BIND_TYPE_TEXT_PCREL32                      3
+
+#define BIND_SPECIAL_DYLIB_SELF                     0
+#define BIND_SPECIAL_DYLIB_MAIN_EXECUTABLE          (-1)
+#define BIND_SPECIAL_DYLIB_FLAT_LOOKUP              (-2)
+#define BIND_SPECIAL_DYLIB_WEAK_LOOKUP              (-3)
+
+#define BIND_SYMBOL_FLAGS_WEAK_IMPORT               0x1
+
+#define BIND_OPCODE_MASK                            0xF0
+#define BIND_IMMEDIATE_MASK                         0x0F
+#define BIND_OPCODE_DONE                            0x00
+#define BIND_OPCODE_SET_DYLIB_ORDINAL_IMM           0x10
+#define BIND_OPCODE_SET_DYLIB_ORDINAL_ULEB          0x20
+#define BIND_OPCODE_SET_DYLIB_SPECIAL_IMM           0x30
+#define BIND_OPCODE_SET_SYMBOL_TRAILING_FLAGS_IMM   0x40
+#define BIND_OPCODE_SET_TYPE_IMM                    0x50
+#define BIND_OPCODE_SET_ADDEND_SLEB                 0x60
+#define BIND_OPCODE_SET_SEGMENT_AND_OFFSET_ULEB     0x70
+#define BIND_OPCODE_ADD_ADDR_ULEB                   0x80
+#define BIND_OPCODE_DO_BIND                         0x90
+#define BIND_OPCODE_DO_BIND_ADD_ADDR_ULEB           0xA0
+#define BIND_OPCODE_DO_BIND_ADD_ADDR_IMM_SCALED     0xB0
+#define BIND_OPCODE_DO_BIND_ULEB_TIMES_SKIPPING_ULEB 0xC0
+#define BIND_OPCODE_THREADED                        0xD0
+
+#endif
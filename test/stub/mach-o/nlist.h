@@ -0,0 +1,39 @@
+/*
+ * Minimal stand-in for <mach-o/nlist.h> for the Linux fixture tests.
+ */
+#ifndef FISHHOOK_TEST_STUB_NLIST_H
+#define FISHHOOK_TEST_STUB_NLIST_H
+
+#include <stdint.h>
+
+struct nlist {
+    union {
+        uint32_t n_strx;
+    } n_un;
+    uint8_t n_type;
+    uint8_t n_sect;
+    int16_t n_desc;
+    uint32_t n_value;
+};
+
+struct nlist_64 {
+    union {
+        uint32_t n_strx;
+    } n_un;
+    uint8_t n_type;
+    uint8_t n_sect;
+    uint16_t n_desc;
+    uint64_t n_value;
+};
+
+#define N_UNDF 0x0
+#define N_EXT  0x01
+
+#define GET_LIBRARY_ORDINAL(n_desc) (((n_desc) >> 8) & 0xff)
+#define SET_LIBRARY_ORDINAL(n_desc, ordinal) ((n_desc) = (((n_desc) & 0x00ff) | (((ordinal) & 0xff) << 8)))
+#define SELF_LIBRARY_ORDINAL   0x0
+#define MAX_LIBRARY_ORDINAL    0xfd
+#define DYNAMIC_LOOKUP_ORDINAL 0xfe
+#define EXECUTABLE_ORDINAL     0xff
+
+#endif
@@ -0,0 +1,45 @@
+/*
+ * Minimal stand-in for <mach/mach.h>, covering only what fishhook.c uses, so
+ * that the fixture tests build on Linux. Not a general replacement.
+ */
+#ifndef FISHHOOK_TEST_STUB_MACH_H
+#define FISHHOOK_TEST_STUB_MACH_H
+
+#include <stdint.h>
+
+typedef int kern_return_t;
+typedef unsigned int mach_port_t;
+typedef int vm_prot_t;
+typedef uintptr_t vm_address_t;
+typedef uintptr_t vm_size_t;
+typedef mach_port_t memory_object_name_t;
+typedef unsigned int mach_msg_type_number_t;
+typedef int *vm_region_info_t;
+typedef int *vm_region_info_64_t;
+
+typedef struct {
+    vm_prot_t protection;
+    vm_prot_t max_protection;
+    int reserved[7];
+} vm_region_basic_info_data_t, vm_region_basic_info_data_64_t;
+
+#define KERN_SUCCESS 0
+#define KERN_INVALID_ADDRESS 1
+
+#define VM_PROT_NONE    0x0
+#define VM_PROT_READ    0x1
+#define VM_PROT_WRITE   0x2
+#define VM_PROT_EXECUTE 0x4
+
+#define VM_REGION_BASIC_INFO       10
+#define VM_REGION_BASIC_INFO_64    9
+#define VM_REGION_BASIC_INFO_COUNT    ((mach_msg_type_number_t)(sizeof(vm_region_basic_info_data_t) / sizeof(int)))
+#define VM_REGION_BASIC_INFO_COUNT_64 ((mach_msg_type_number_t)(sizeof(vm_region_basic_info_data_64_t) / sizeof(int)))
+
+mach_port_t mach_task_self(void);
+kern_return_t vm_region(mach_port_t task, vm_address_t *address, vm_size_t *size, int flavor,
+                        vm_region_info_t info, mach_msg_type_number_t *count, memory_object_name_t *object);
+kern_return_t vm_region_64(mach_port_t task, vm_address_t *address, vm_size_t *size, int flavor,
+                           vm_region_info_64_t info, mach_msg_type_number_t *count, memory_object_name_t *object);
+
+#endif
@@ -0,0 +1 @@
+#include <mach/mach.h>
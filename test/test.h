@@ -0,0 +1,21 @@
+/*
+ * A minimal check macro for the fixture tests: failures are printed and
+ * counted, and TEST_RESULT() turns the count into the exit status.
+ */
+#ifndef FISHHOOK_TEST_TEST_H
+#define FISHHOOK_TEST_TEST_H
+
+#include <stdio.h>
+
+static int test_failures;
+
+#define CHECK(condition) do { \
+    if (!(condition)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+        test_failures++; \
+    } \
+} while (0)
+
+#define TEST_RESULT() (printf("%s: %s\n", __FILE__, test_failures ? "FAIL" : "ok"), test_failures != 0)
+
+#endif
@@ -0,0 +1,114 @@
+/*
+ * Fixtures for rebind_symbols_async: the handle reaches the add-image callback
+ * that dyld replays on the background thread, no dyld function is called and
+ * no image_callback runs with fishhook's lock held, and images named in
+ * sync_images are rebound on the calling thread only once.
+ */
+#include "../fishhook.c"
+
+#include "fake_image.h"
+#include "stub/dyld_stub.h"
+#include "test.h"
+
+#define VALUE(x) ((void *)(uintptr_t)(x))
+
+static const struct fake_symbol symbols[] = { { "_close", 1 }, { "_open", 1 } };
+static const char *const dylibs[] = { "/usr/lib/libSystem.B.dylib" };
+static _Atomic int locked_calls;
+
+static void **build(struct fake_image *image) {
+    return fake_image_build(image, symbols, 2, dylibs, 1, "__DATA", S_NON_LAZY_SYMBOL_POINTERS);
+}
+
+static void add(struct fake_image *image, const char *name) {
+    stub_dyld_add_image((const struct mach_header *)fake_header(image), fake_slide(image), name);
+}
+
+// 递归锁：本线程持有时 trylock 也会成功，此时层数不为 0
+static void check_unlocked(const char *function) {
+    if (pthread_mutex_trylock(&_rebindings_lock) == 0) {
+        if (_rebindings_lock_depth != 0) {
+            fprintf(stderr, "%s called with the rebindings lock held\n", function);
+            locked_calls++;
+        }
+        pthread_mutex_unlock(&_rebindings_lock);
+    }
+}
+
+struct callback_log {
+    pthread_t caller;
+    const void *headers[8];
+    _Atomic int count;
+    _Atomic int on_caller;
+    _Atomic int nested_failures;
+};
+
+static void image_rebound(const void *header, intptr_t slide, void *context) {
+    (void)slide;
+    struct callback_log *log = (struct callback_log *)context;
+    check_unlocked("image_callback");
+    int index = log->count++;
+    if (index < 8) {
+        log->headers[index] = header;
+    }
+    if (pthread_equal(pthread_self(), log->caller)) {
+        log->on_caller++;
+    }
+    if (rebind_symbols_verify(NULL, 0) < 0) {                             // 回调中可以再调用 fishhook
+        log->nested_failures++;
+    }
+}
+
+static int times_called(const struct callback_log *log, struct fake_image *image) {
+    int times = 0;
+    for (int i = 0; i < log->count && i < 8; i++) {
+        times += log->headers[i] == fake_header(image);
+    }
+    return times;
+}
+
+static void test_first_registration(void) {
+    static struct fake_image critical, other;
+    void **critical_slots = build(&critical);
+    void **other_slots = build(&other);
+    add(&critical, "/System/Library/Critical.framework/Critical");
+    add(&other, "/usr/lib/libother.dylib");
+    stub_dyld_set_observer(check_unlocked);
+    
+    struct callback_log log = { .caller = pthread_self() };
+    struct rebinding rebindings[] = { { "close", VALUE(0xc1), NULL } };
+    const char *const sync_images[] = { "Critical" };
+    struct rebind_async *async = rebind_symbols_async(rebindings, 1, sync_images, 1, image_rebound, &log);
+    CHECK(async != NULL);
+    CHECK(critical_slots[0] == VALUE(0xc1));                                  // 返回前已完成
+    CHECK(rebind_symbols_async_wait(async) == 0);
+    CHECK(other_slots[0] == VALUE(0xc1));
+    CHECK(log.count == 2);
+    CHECK(log.on_caller == 1);
+    CHECK(times_called(&log, &critical) == 1);
+    CHECK(times_called(&log, &other) == 1);
+    CHECK(log.nested_failures == 0);
+    CHECK(stub_dyld_add_callback_count() == 1);
+    
+    // 之后加载的镜像按普通回调处理，不再通知已结束的 handle
+    static struct fake_image later;
+    void **later_slots = build(&later);
+    add(&later, "later");
+    CHECK(later_slots[0] == VALUE(0xc1));
+    CHECK(log.count == 2);
+    
+    struct callback_log again = { .caller = pthread_self() };
+    struct rebinding more[] = { { "open", VALUE(0x01), NULL } };
+    async = rebind_symbols_async(more, 1, NULL, 0, image_rebound, &again);
+    CHECK(rebind_symbols_async_wait(async) == 0);
+    CHECK(critical_slots[1] == VALUE(0x01) && other_slots[1] == VALUE(0x01) && later_slots[1] == VALUE(0x01));
+    CHECK(again.count == 3);
+    CHECK(stub_dyld_add_callback_count() == 1);
+    CHECK(locked_calls == 0);
+    stub_dyld_set_observer(NULL);
+}
+
+int main(void) {
+    test_first_registration();
+    return TEST_RESULT();
+}
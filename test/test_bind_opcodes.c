@@ -0,0 +1,347 @@
+/*
+ * Byte-stream fixtures for the LC_DYLD_INFO decoder: ULEB/SLEB reads, the bind
+ * opcodes fishhook understands, malformed and wrapping streams, and a
+ * bind-only image rebound end to end.
+ */
+#include "../fishhook.c"
+
+#include "fake_image.h"
+#include "test.h"
+
+#include <stdlib.h>
+
+static uint64_t segment_memory[64];
+
+static const struct image_segment test_segments[] = {
+    { .start = (uintptr_t)segment_memory, .size = sizeof(segment_memory) },
+};
+
+static size_t decode(const uint8_t *stream, size_t size, bool lazy, bool *ok, struct bind_table *table, struct arena *arena) {
+    *table = (struct bind_table){ NULL, NULL, sizeof(segment_memory) / sizeof(void *) };
+    *ok = decode_bind_opcodes(arena, table, stream, stream + size, lazy, test_segments, 1);
+    size_t count = 0;
+    for (struct bound_pointer_block *block = table->head; block; block = block->next) {
+        count += block->count;
+    }
+    return count;
+}
+
+static void test_uleb128(void) {
+    static const struct {
+        uint8_t bytes[11];
+        size_t size;
+        bool ok;
+        uint64_t value;
+    } cases[] = {
+        { { 0x00 }, 1, true, 0 },
+        { { 0x7f }, 1, true, 127 },
+        { { 0x80, 0x01 }, 2, true, 128 },
+        { { 0xe5, 0x8e, 0x26 }, 3, true, 624485 },
+        { { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x01 }, 10, true, UINT64_MAX },
+        { { 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x00 }, 11, true, 0 },  // 多余的零字节
+        { { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x02 }, 10, false, 0 },       // 超出 64 位
+        { { 0x80 }, 1, false, 0 },                                                               // 没有结尾
+        { { 0 }, 0, false, 0 },
+    };
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        const uint8_t *p = cases[i].bytes;
+        uint64_t value = 0;
+        bool ok = read_uleb128(&p, cases[i].bytes + cases[i].size, &value);
+        CHECK(ok == cases[i].ok);
+        if (ok) {
+            CHECK(value == cases[i].value);
+            CHECK(p == cases[i].bytes + cases[i].size);
+        }
+    }
+}
+
+static void test_sleb128(void) {
+    static const struct {
+        uint8_t bytes[10];
+        size_t size;
+        bool ok;
+        int64_t value;
+    } cases[] = {
+        { { 0x00 }, 1, true, 0 },
+        { { 0x02 }, 1, true, 2 },
+        { { 0x7e }, 1, true, -2 },
+        { { 0xff, 0x00 }, 2, true, 127 },
+        { { 0x81, 0x7f }, 2, true, -127 },
+        { { 0xc0, 0xbb, 0x78 }, 3, true, -123456 },
+        { { 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x7f }, 10, true, INT64_MIN },
+        { { 0xc0 }, 1, false, 0 },
+    };
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        const uint8_t *p = cases[i].bytes;
+        int64_t value = 0;
+        bool ok = read_sleb128(&p, cases[i].bytes + cases[i].size, &value);
+        CHECK(ok == cases[i].ok);
+        if (ok) {
+            CHECK(value == cases[i].value);
+        }
+    }
+}
+
+static void test_bind_stream(void) {
+    struct arena arena = {0};
+    struct bind_table table;
+    bool ok;
+    // _a 绑定到 offset 8，随后 _b 以 ULEB 次数和间隔绑定 3 次，最后一次越出段的绑定被丢弃
+    static const uint8_t stream[] = {
+        BIND_OPCODE_SET_DYLIB_ORDINAL_IMM | 2,
+        BIND_OPCODE_SET_SYMBOL_TRAILING_FLAGS_IMM, '_', 'a', 0,
+        BIND_OPCODE_SET_TYPE_IMM | BIND_TYPE_POINTER,
+        BIND_OPCODE_SET_SEGMENT_AND_OFFSET_ULEB | 0, 8,
+        BIND_OPCODE_DO_BIND,
+        BIND_OPCODE_SET_DYLIB_SPECIAL_IMM | (BIND_SPECIAL_DYLIB_FLAT_LOOKUP & BIND_IMMEDIATE_MASK),
+        BIND_OPCODE_SET_SYMBOL_TRAILING_FLAGS_IMM, '_', 'b', 0,
+        BIND_OPCODE_ADD_ADDR_ULEB, 8,
+        BIND_OPCODE_DO_BIND_ULEB_TIMES_SKIPPING_ULEB, 3, 16,
+        BIND_OPCODE_SET_SEGMENT_AND_OFFSET_ULEB | 0, 0xf8, 0x03,               // 最后一个 slot
+        BIND_OPCODE_DO_BIND_ADD_ADDR_IMM_SCALED | 1,
+        BIND_OPCODE_DO_BIND,                                                  // 已出段，忽略
+        BIND_OPCODE_DONE,
+        BIND_OPCODE_DO_BIND,                                                  // DONE 之后不再解码
+    };
+    size_t count = decode(stream, sizeof(stream), false, &ok, &table, &arena);
+    CHECK(ok);
+    CHECK(count == 5);
+    if (count == 5) {
+        const struct bound_pointer *entries = table.head->entries;
+        CHECK(entries[0].slot == (void **)&segment_memory[1]);
+        CHECK(strcmp(entries[0].symbol_name, "_a") == 0);
+        CHECK(entries[0].library_ordinal == 2);
+        CHECK(!entries[0].lazy);
+        CHECK(entries[1].slot == (void **)&segment_memory[3]);
+        CHECK(entries[2].slot == (void **)&segment_memory[6]);
+        CHECK(entries[3].slot == (void **)&segment_memory[9]);
+        CHECK(strcmp(entries[3].symbol_name, "_b") == 0);
+        CHECK(entries[3].library_ordinal == 0);                               // 特殊序号记为 0
+        CHECK(entries[4].slot == (void **)&segment_memory[63]);
+    }
+    
+    // 懒绑定流中 DONE 只是分隔符
+    static const uint8_t lazy_stream[] = {
+        BIND_OPCODE_SET_SEGMENT_AND_OFFSET_ULEB | 0, 0, BIND_OPCODE_SET_DYLIB_ORDINAL_IMM | 1,
+        BIND_OPCODE_SET_SYMBOL_TRAILING_FLAGS_IMM, '_', 'x', 0, BIND_OPCODE_DO_BIND, BIND_OPCODE_DONE,
+        BIND_OPCODE_SET_SEGMENT_AND_OFFSET_ULEB | 0, 8, BIND_OPCODE_SET_DYLIB_ORDINAL_ULEB, 3,
+        BIND_OPCODE_SET_SYMBOL_TRAILING_FLAGS_IMM, '_', 'y', 0, BIND_OPCODE_DO_BIND, BIND_OPCODE_DONE,
+    };
+    count = decode(lazy_stream, sizeof(lazy_stream), true, &ok, &table, &arena);
+    CHECK(ok);
+    CHECK(count == 2);
+    if (count == 2) {
+        CHECK(table.head->entries[1].library_ordinal == 3);
+        CHECK(table.head->entries[1].lazy);
+    }
+    
+    // 带 addend、非指针类型或未对齐的绑定不是 slot
+    static const uint8_t skipped[] = {
+        BIND_OPCODE_SET_SYMBOL_TRAILING_FLAGS_IMM, '_', 'z', 0,
+        BIND_OPCODE_SET_SEGMENT_AND_OFFSET_ULEB | 0, 0,
+        BIND_OPCODE_SET_ADDEND_SLEB, 0x7f, BIND_OPCODE_DO_BIND,
+        BIND_OPCODE_SET_ADDEND_SLEB, 0, BIND_OPCODE_SET_TYPE_IMM | BIND_TYPE_TEXT_ABSOLUTE32, BIND_OPCODE_DO_BIND,
+        BIND_OPCODE_SET_TYPE_IMM | BIND_TYPE_POINTER, BIND_OPCODE_SET_SEGMENT_AND_OFFSET_ULEB | 0, 4, BIND_OPCODE_DO_BIND,
+        BIND_OPCODE_SET_SEGMENT_AND_OFFSET_ULEB | 1, 0, BIND_OPCODE_DO_BIND,           // 不存在的段
+        BIND_OPCODE_DONE,
+    };
+    count = decode(skipped, sizeof(skipped), false, &ok, &table, &arena);
+    CHECK(ok);
+    CHECK(count == 0);
+    
+    // ld64 用回绕的单次间隔向低地址移动
+    static const uint8_t backwards[] = {
+        BIND_OPCODE_SET_SYMBOL_TRAILING_FLAGS_IMM, '_', 'w', 0,
+        BIND_OPCODE_SET_SEGMENT_AND_OFFSET_ULEB | 0, 0x80, 0x01,
+        BIND_OPCODE_DO_BIND_ADD_ADDR_ULEB, 0xe8, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x01,  // -24
+        BIND_OPCODE_DO_BIND,
+        BIND_OPCODE_DONE,
+    };
+    count = decode(backwards, sizeof(backwards), false, &ok, &table, &arena);
+    CHECK(ok);
+    CHECK(count == 2);
+    if (count == 2) {
+        CHECK(table.head->entries[0].slot == (void **)&segment_memory[16]);
+        CHECK(table.head->entries[1].slot == (void **)&segment_memory[14]);
+    }
+    
+    // 链式绑定结束解码，之前的结果保留
+    static const uint8_t threaded[] = {
+        BIND_OPCODE_SET_SYMBOL_TRAILING_FLAGS_IMM, '_', 't', 0,
+        BIND_OPCODE_SET_SEGMENT_AND_OFFSET_ULEB | 0, 0, BIND_OPCODE_DO_BIND,
+        BIND_OPCODE_THREADED, BIND_OPCODE_DO_BIND,
+    };
+    count = decode(threaded, sizeof(threaded), false, &ok, &table, &arena);
+    CHECK(ok);
+    CHECK(count == 1);
+    arena_release(&arena);
+}
+
+// 签名按 section 判断：段内 __auth_got 范围中的 slot 才带签名
+static void test_auth_ranges(void) {
+    static const struct auth_range auth_got[] = { { 16, 16 } };
+    static const struct image_segment segments[] = {
+        { .start = (uintptr_t)segment_memory, .size = sizeof(segment_memory), .auth_ranges = auth_got, .auth_ranges_nel = 1 },
+    };
+    static const uint8_t stream[] = {
+        BIND_OPCODE_SET_DYLIB_ORDINAL_IMM | 1,
+        BIND_OPCODE_SET_SYMBOL_TRAILING_FLAGS_IMM, '_', 'a', 0,
+        BIND_OPCODE_SET_SEGMENT_AND_OFFSET_ULEB | 0, 8,
+        BIND_OPCODE_DO_BIND_ULEB_TIMES_SKIPPING_ULEB, 4, 0,
+        BIND_OPCODE_DONE,
+    };
+    struct arena arena = {0};
+    struct bind_table table = { NULL, NULL, sizeof(segment_memory) / sizeof(void *) };
+    CHECK(decode_bind_opcodes(&arena, &table, stream, stream + sizeof(stream), false, segments, 1));
+    CHECK(table.head && table.head->count == 4);
+    if (table.head && table.head->count == 4) {
+        CHECK(!table.head->entries[0].is_auth);
+        CHECK(table.head->entries[1].is_auth);
+        CHECK(table.head->entries[2].is_auth);
+        CHECK(!table.head->entries[3].is_auth);
+    }
+    arena_release(&arena);
+}
+
+static void test_malformed_streams(void) {
+    struct arena arena = {0};
+    struct bind_table table;
+    bool ok;
+    static const uint8_t truncated_uleb[] = { BIND_OPCODE_SET_SEGMENT_AND_OFFSET_ULEB | 0, 0x80 };
+    decode(truncated_uleb, sizeof(truncated_uleb), false, &ok, &table, &arena);
+    CHECK(!ok);
+    static const uint8_t unterminated_name[] = { BIND_OPCODE_SET_SYMBOL_TRAILING_FLAGS_IMM, '_', 'a' };
+    decode(unterminated_name, sizeof(unterminated_name), false, &ok, &table, &arena);
+    CHECK(!ok);
+    static const uint8_t unknown_opcode[] = { 0xe0 };
+    decode(unknown_opcode, sizeof(unknown_opcode), false, &ok, &table, &arena);
+    CHECK(!ok);
+    
+    // 22 字节：间隔 2^64 - 8 让 pointer_size + skip 回绕为 0，offset 原地不动，重复 2^28 - 1 次
+    static const uint8_t wrapping_skip[22] = {
+        BIND_OPCODE_SET_DYLIB_ORDINAL_IMM | 1,
+        BIND_OPCODE_SET_SYMBOL_TRAILING_FLAGS_IMM, '_', 'a', 0,
+        BIND_OPCODE_SET_SEGMENT_AND_OFFSET_ULEB | 0, 0,
+        BIND_OPCODE_DO_BIND_ULEB_TIMES_SKIPPING_ULEB,
+        0xff, 0xff, 0xff, 0x7f,                                               // 2^28 - 1
+        0xf8, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x01,           // 2^64 - 8
+    };
+    size_t count = decode(wrapping_skip, sizeof(wrapping_skip), false, &ok, &table, &arena);
+    CHECK(!ok);
+    CHECK(count == 0);
+    
+    // 重复绑定时的回绕间隔只保留第一次绑定，不会向低地址倒退
+    static const uint8_t walking_backwards[] = {
+        BIND_OPCODE_SET_SYMBOL_TRAILING_FLAGS_IMM, '_', 'a', 0,
+        BIND_OPCODE_SET_SEGMENT_AND_OFFSET_ULEB | 0, 0x10,
+        BIND_OPCODE_DO_BIND_ULEB_TIMES_SKIPPING_ULEB, 0xff, 0xff, 0xff, 0x7f,
+        0xf0, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x01,
+    };
+    count = decode(walking_backwards, sizeof(walking_backwards), false, &ok, &table, &arena);
+    CHECK(ok);
+    CHECK(count == 1);
+    
+    // 重复的单次绑定最多只能填满各段能容纳的指针数
+    uint8_t repeated[4 + 2 + 11 * 80];
+    size_t n = 0;
+    repeated[n++] = BIND_OPCODE_SET_SYMBOL_TRAILING_FLAGS_IMM;
+    repeated[n++] = '_';
+    repeated[n++] = 'r';
+    repeated[n++] = 0;
+    repeated[n++] = BIND_OPCODE_SET_SEGMENT_AND_OFFSET_ULEB | 0;
+    repeated[n++] = 0;
+    while (n < sizeof(repeated)) {
+        static const uint8_t minus_pointer[] = { 0xf8, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x01 };
+        repeated[n++] = BIND_OPCODE_DO_BIND_ADD_ADDR_ULEB;                    // 间隔 -8：每次都绑定同一个 slot
+        memcpy(&repeated[n], minus_pointer, sizeof(minus_pointer));
+        n += sizeof(minus_pointer);
+    }
+    count = decode(repeated, sizeof(repeated), false, &ok, &table, &arena);
+    CHECK(!ok);
+    CHECK(count == sizeof(segment_memory) / sizeof(void *));
+    arena_release(&arena);
+}
+
+// 随机改写合法的流：解码必须终止，且得到的 slot 都在段内并且对齐
+static void test_mutated_streams(void) {
+    static const uint8_t seed[] = {
+        BIND_OPCODE_SET_DYLIB_ORDINAL_IMM | 1,
+        BIND_OPCODE_SET_SYMBOL_TRAILING_FLAGS_IMM, '_', 'a', 0,
+        BIND_OPCODE_SET_TYPE_IMM | BIND_TYPE_POINTER,
+        BIND_OPCODE_SET_SEGMENT_AND_OFFSET_ULEB | 0, 8,
+        BIND_OPCODE_DO_BIND,
+        BIND_OPCODE_DO_BIND_ULEB_TIMES_SKIPPING_ULEB, 3, 8,
+        BIND_OPCODE_ADD_ADDR_ULEB, 0x10,
+        BIND_OPCODE_DO_BIND_ADD_ADDR_IMM_SCALED | 2,
+        BIND_OPCODE_SET_ADDEND_SLEB, 0,
+        BIND_OPCODE_DO_BIND_ADD_ADDR_ULEB, 8,
+        BIND_OPCODE_DONE,
+    };
+    srand(1);
+    for (int iteration = 0; iteration < 20000; iteration++) {
+        uint8_t stream[sizeof(seed)];
+        memcpy(stream, seed, sizeof(seed));
+        for (int k = 1 + rand() % 6; k > 0; k--) {
+            size_t at = (size_t)rand() % sizeof(stream);
+            stream[at] = rand() % 3 ? (uint8_t)rand() : (uint8_t)(stream[at] ^ (1u << (rand() % 8)));
+        }
+        struct arena arena = {0};
+        struct bind_table table;
+        bool ok;
+        decode(stream, (size_t)rand() % (sizeof(stream) + 1), iteration & 1, &ok, &table, &arena);
+        for (struct bound_pointer_block *block = table.head; block; block = block->next) {
+            for (size_t i = 0; i < block->count; i++) {
+                uintptr_t slot = (uintptr_t)block->entries[i].slot;
+                if (slot < (uintptr_t)segment_memory || slot >= (uintptr_t)(segment_memory + 64) || slot % sizeof(void *)) {
+                    CHECK(!"slot outside the segment");
+                }
+            }
+        }
+        arena_release(&arena);
+    }
+}
+
+// 没有间接符号表的镜像按绑定操作码重绑定，懒绑定流中的库限定同样有效
+static void test_bind_only_image(void) {
+    static struct fake_image image;
+    static const struct fake_symbol symbols[] = { { "_close", 1 }, { "_open", 2 } };
+    static const char *const dylibs[] = { "/usr/lib/libSystem.B.dylib", "/x/libfoo.dylib" };
+    void **slots = fake_image_build(&image, symbols, 2, dylibs, 2, SEG_DATA, S_NON_LAZY_SYMBOL_POINTERS);
+    static const uint8_t bind[] = {
+        BIND_OPCODE_SET_DYLIB_ORDINAL_IMM | 1,
+        BIND_OPCODE_SET_SYMBOL_TRAILING_FLAGS_IMM, '_', 'c', 'l', 'o', 's', 'e', 0,
+        BIND_OPCODE_SET_TYPE_IMM | BIND_TYPE_POINTER,
+        BIND_OPCODE_SET_SEGMENT_AND_OFFSET_ULEB | 0, 0,
+        BIND_OPCODE_DO_BIND,
+        BIND_OPCODE_DONE,
+    };
+    static const uint8_t lazy_bind[] = {
+        BIND_OPCODE_SET_SEGMENT_AND_OFFSET_ULEB | 0, 8,
+        BIND_OPCODE_SET_DYLIB_ORDINAL_IMM | 2,
+        BIND_OPCODE_SET_SYMBOL_TRAILING_FLAGS_IMM, '_', 'o', 'p', 'e', 'n', 0,
+        BIND_OPCODE_DO_BIND,
+        BIND_OPCODE_DONE,
+    };
+    fake_image_use_bind_opcodes(&image, bind, sizeof(bind), lazy_bind, sizeof(lazy_bind));
+    struct rebinding rebindings[] = {
+        { "close", (void *)0xc1, NULL },
+        { "open@libbar.dylib", (void *)0xb0, NULL },
+    };
+    CHECK(rebind_symbols_image(fake_header(&image), fake_slide(&image), rebindings, 2) == 0);
+    CHECK(slots[0] == (void *)0xc1);
+    CHECK(slots[1] == (void *)0x1001);                                        // 库名不符
+    struct rebinding qualified[] = { { "open@libfoo.dylib", (void *)0xf0, NULL } };
+    CHECK(rebind_symbols_image(fake_header(&image), fake_slide(&image), qualified, 1) == 0);
+    CHECK(slots[1] == (void *)0xf0);
+}
+
+int main(void) {
+    test_uleb128();
+    test_sleb128();
+    test_bind_stream();
+    test_auth_ranges();
+    test_malformed_streams();
+    test_mutated_streams();
+    test_bind_only_image();
+    return TEST_RESULT();
+}
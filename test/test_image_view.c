@@ -0,0 +1,211 @@
+/*
+ * Fixtures for build_image_view and the per-header view cache: the load
+ * commands and tables of a well-formed image, each way a malformed one is
+ * rejected, sections that are skipped rather than rejected, and the cache's
+ * handling of rejected and unloaded images.
+ */
+#include "../fishhook.c"
+
+#include "fake_image.h"
+#include "stub/dyld_stub.h"
+#include "test.h"
+
+static const struct fake_symbol symbols[] = { { "_close", 1 }, { "_open", 1 }, { "_read", 2 } };
+static const char *const dylibs[] = { "/usr/lib/libSystem.B.dylib", "/x/libfoo.dylib" };
+
+static void **build(struct fake_image *image) {
+    return fake_image_build(image, symbols, 3, dylibs, 2, "__DATA_CONST", S_NON_LAZY_SYMBOL_POINTERS);
+}
+
+static struct image_view *view_of(struct fake_image *image, struct arena *arena) {
+    return build_image_view(arena, (const struct mach_header *)fake_header(image), fake_slide(image));
+}
+
+static struct section_64 *first_section(struct fake_image *image) {
+    return (struct section_64 *)((struct segment_command_64 *)fake_find_command(image, LC_SEGMENT_64) + 1);
+}
+
+static void test_well_formed(void) {
+    static struct fake_image image;
+    void **slots = build(&image);
+    struct arena arena = {0};
+    struct image_view *view = view_of(&image, &arena);
+    CHECK(view != NULL);
+    if (view) {
+        CHECK(view->segments_nel == 2);
+        CHECK(view->segments[0].start == (uintptr_t)slots);
+        CHECK(view->segments[0].may_be_read_only);                            // __DATA_CONST
+        CHECK(view->dylib_count == 2);
+        CHECK(strcmp(view->dylib_names[1], "/x/libfoo.dylib") == 0);
+        CHECK(view->nundefsym == 3);
+        CHECK(view->sections_nel == 1);
+        CHECK(view->sections[0].bindings == slots);
+        CHECK(view->sections[0].count == 3);
+        CHECK(view->sections[0].segment == 0);
+        CHECK(view->binds == NULL);
+    }
+    arena_release(&arena);
+}
+
+// __auth_got 常常位于 __DATA_CONST 中，签名按 section 判断
+static void test_auth_sections(void) {
+    static struct fake_image plain, auth;
+    struct arena arena = {0};
+    build(&plain);
+    struct image_view *view = view_of(&plain, &arena);
+    CHECK(view && view->sections_nel == 1 && !view->sections[0].is_auth);
+    CHECK(view && view->segments[0].auth_ranges_nel == 0);
+    
+    build(&auth);
+    strncpy(first_section(&auth)->sectname, "__auth_got", sizeof(first_section(&auth)->sectname));
+    view = view_of(&auth, &arena);
+    CHECK(view && view->sections_nel == 1 && view->sections[0].is_auth);
+    CHECK(view && view->segments[0].auth_ranges_nel == 1);
+    if (view && view->segments[0].auth_ranges_nel == 1) {
+        CHECK(view->segments[0].auth_ranges[0].offset == 0);
+        CHECK(view->segments[0].auth_ranges[0].size == 3 * sizeof(void *));
+    }
+    arena_release(&arena);
+}
+
+// 每种畸形输入都必须让整个镜像被拒绝
+static void test_rejected(void) {
+    static struct fake_image images[9];
+    struct arena arena = {0};
+    int n = 0;
+    
+    build(&images[n]);
+    fake_header(&images[n])->sizeofcmds -= 8;                                 // 最后一条命令越过 sizeofcmds
+    CHECK(view_of(&images[n++], &arena) == NULL);
+    
+    build(&images[n]);
+    fake_find_command(&images[n], LC_SYMTAB)->cmdsize = 0;
+    CHECK(view_of(&images[n++], &arena) == NULL);
+    
+    build(&images[n]);
+    ((struct segment_command_64 *)fake_find_command(&images[n], LC_SEGMENT_64))->nsects = 2;  // section 超出命令
+    CHECK(view_of(&images[n++], &arena) == NULL);
+    
+    build(&images[n]);
+    ((struct symtab_command *)fake_find_command(&images[n], LC_SYMTAB))->symoff = FAKE_PAGE;  // 不在 __LINKEDIT 中
+    CHECK(view_of(&images[n++], &arena) == NULL);
+    
+    build(&images[n]);
+    ((struct symtab_command *)fake_find_command(&images[n], LC_SYMTAB))->strsize = 1u << 30;
+    CHECK(view_of(&images[n++], &arena) == NULL);
+    
+    build(&images[n]);
+    struct symtab_command *symtab_cmd = (struct symtab_command *)fake_find_command(&images[n], LC_SYMTAB);
+    images[n].bytes[symtab_cmd->stroff + symtab_cmd->strsize - 1] = 'x';     // 字符串表没有结尾
+    CHECK(view_of(&images[n++], &arena) == NULL);
+    
+    build(&images[n]);
+    ((struct dysymtab_command *)fake_find_command(&images[n], LC_DYSYMTAB))->nundefsym = 4;
+    CHECK(view_of(&images[n++], &arena) == NULL);
+    
+    build(&images[n]);
+    ((struct nlist_64 *)(images[n].bytes + 2 * FAKE_PAGE))[1].n_un.n_strx = 4000;
+    CHECK(view_of(&images[n++], &arena) == NULL);
+    
+    build(&images[n]);
+    struct dylib_command *dylib_cmd = (struct dylib_command *)fake_find_command(&images[n], LC_LOAD_DYLIB);
+    memset((char *)dylib_cmd + dylib_cmd->dylib.name.offset, 'x', dylib_cmd->cmdsize - dylib_cmd->dylib.name.offset);
+    CHECK(view_of(&images[n++], &arena) == NULL);
+    
+    arena_release(&arena);
+}
+
+// 单个 section 校验不通过只跳过它，镜像本身仍然可用
+static void test_skipped_sections(void) {
+    static struct fake_image outside, bad_index, local, bare;
+    struct arena arena = {0};
+    
+    build(&outside);
+    first_section(&outside)->size = 2 * FAKE_PAGE;
+    struct image_view *view = view_of(&outside, &arena);
+    CHECK(view && view->sections_nel == 0);
+    
+    build(&bad_index);
+    ((uint32_t *)(bad_index.bytes + 3 * FAKE_PAGE))[2] = 3;                  // 超出符号表
+    view = view_of(&bad_index, &arena);
+    CHECK(view && view->sections_nel == 0);
+    
+    build(&local);
+    ((uint32_t *)(local.bytes + 3 * FAKE_PAGE))[2] = INDIRECT_SYMBOL_LOCAL;
+    view = view_of(&local, &arena);
+    CHECK(view && view->sections_nel == 1);
+    
+    build(&bare);                                                             // 既没有间接符号表也没有绑定信息
+    ((struct dysymtab_command *)fake_find_command(&bare, LC_DYSYMTAB))->nindirectsyms = 0;
+    view = view_of(&bare, &arena);
+    CHECK(view && view->sections_nel == 0 && view->binds == NULL);
+    arena_release(&arena);
+}
+
+static size_t count_chunks(const struct arena *arena) {
+    size_t count = 0;
+    for (struct arena_chunk *chunk = arena->chunks; chunk; chunk = chunk->next) {
+        count++;
+    }
+    return count;
+}
+
+static size_t count_views(void) {
+    size_t count = 0;
+    for (struct image_view *view = _image_views; view; view = view->next) {
+        count++;
+    }
+    return count;
+}
+
+// 被拒绝的镜像只留下一个标记，重放时不再校验，也不再占用内存
+static void test_rejection_is_cached(void) {
+    static struct fake_image image;
+    void **slots = build(&image);
+    ((struct symtab_command *)fake_find_command(&image, LC_SYMTAB))->strsize = 1u << 30;
+    struct rebinding rebindings[] = { { "close", (void *)0xc1, NULL } };
+    size_t views = count_views();
+    rebind_symbols_image(fake_header(&image), fake_slide(&image), rebindings, 1);
+    size_t chunks = count_chunks(&_image_views_arena);
+    size_t used = _image_views_arena.chunks->used;
+    for (int i = 0; i < 5; i++) {
+        rebind_symbols_image(fake_header(&image), fake_slide(&image), rebindings, 1);
+    }
+    CHECK(slots[0] == (void *)0x1000);
+    CHECK(count_views() == views + 1);
+    CHECK(_image_views && _image_views->rejected);
+    CHECK(count_chunks(&_image_views_arena) == chunks);
+    CHECK(_image_views_arena.chunks->used == used);
+}
+
+// 镜像卸载后缓存可能变空，之后的查找不能再注册一次 remove-image 回调
+static void test_unloaded_views(void) {
+    static struct fake_image first, second;
+    build(&first);
+    build(&second);
+    struct rebinding rebindings[] = { { "close", (void *)0xc1, NULL } };
+    rebind_symbols_image(fake_header(&first), fake_slide(&first), rebindings, 1);
+    CHECK(stub_dyld_remove_callback_count() == 1);
+    
+    lock_rebindings();
+    while (_image_views) {
+        _forget_image_view(_image_views->header, _image_views->slide);
+    }
+    unlock_rebindings();
+    
+    stub_dyld_add_image((const struct mach_header *)fake_header(&first), fake_slide(&first), "first");
+    stub_dyld_remove_image((const struct mach_header *)fake_header(&first));
+    rebind_symbols_image(fake_header(&second), fake_slide(&second), rebindings, 1);
+    CHECK(stub_dyld_remove_callback_count() == 1);
+    CHECK(fake_slots(&second)[0] == (void *)0xc1);
+}
+
+int main(void) {
+    test_well_formed();
+    test_auth_sections();
+    test_rejected();
+    test_skipped_sections();
+    test_rejection_is_cached();
+    test_unloaded_views();
+    return TEST_RESULT();
+}
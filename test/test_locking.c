@@ -0,0 +1,174 @@
+/*
+ * Lock ordering fixtures: dyld runs its callbacks with its loader lock held and
+ * fishhook's callbacks then take the rebindings lock, so fishhook must never
+ * call into dyld while holding that lock. The stub's observer checks every
+ * dyld call, and a thread loading and unloading images under the loader lock
+ * races the public entry points.
+ */
+#include "../fishhook.c"
+
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "fake_image.h"
+#include "stub/dyld_stub.h"
+#include "test.h"
+
+#define VALUE(x) ((void *)(uintptr_t)(x))
+
+static const struct fake_symbol symbols[] = { { "_close", 1 }, { "_open", 1 } };
+static const char *const dylibs[] = { "/usr/lib/libSystem.B.dylib" };
+static _Atomic int locked_dyld_calls;
+
+static void **build(struct fake_image *image) {
+    return fake_image_build(image, symbols, 2, dylibs, 1, "__DATA", S_NON_LAZY_SYMBOL_POINTERS);
+}
+
+static void add(struct fake_image *image, const char *name) {
+    stub_dyld_add_image((const struct mach_header *)fake_header(image), fake_slide(image), name);
+}
+
+// 递归锁：本线程持有时 trylock 也会成功，此时层数不为 0
+static void check_unlocked(const char *function) {
+    if (pthread_mutex_trylock(&_rebindings_lock) == 0) {
+        if (_rebindings_lock_depth != 0) {
+            fprintf(stderr, "%s called with the rebindings lock held\n", function);
+            locked_dyld_calls++;
+        }
+        pthread_mutex_unlock(&_rebindings_lock);
+    }
+}
+
+static void test_no_dyld_calls_under_lock(void) {
+    static struct fake_image loaded, later, explicit;
+    void **loaded_slots = build(&loaded);
+    void **later_slots = build(&later);
+    void **explicit_slots = build(&explicit);
+    stub_dyld_set_observer(check_unlocked);
+    add(&loaded, "loaded");
+    
+    struct rebinding first[] = { { "close", VALUE(0xc1), NULL } };
+    struct rebinding second[] = { { "open", VALUE(0x01), NULL } };
+    CHECK(rebind_symbols(first, 1) == 0);
+    CHECK(loaded_slots[0] == VALUE(0xc1));
+    CHECK(rebind_symbols(second, 1) == 0);
+    CHECK(loaded_slots[1] == VALUE(0x01));
+    add(&later, "later");
+    CHECK(later_slots[0] == VALUE(0xc1) && later_slots[1] == VALUE(0x01));
+    struct rebinding image_only[] = { { "close", VALUE(0xc2), NULL } };
+    CHECK(rebind_symbols_image(fake_header(&explicit), fake_slide(&explicit), image_only, 1) == 0);
+    CHECK(explicit_slots[0] == VALUE(0xc2));
+    CHECK(rebind_symbols_swap(VALUE(0x01), VALUE(0x02)) == 2);
+    CHECK(rebind_symbols_verify(NULL, 0) == 0);
+    stub_dyld_remove_image((const struct mach_header *)fake_header(&later));
+    CHECK(rebind_symbols_detach(VALUE(0x02)) == 1);
+    
+    CHECK(stub_dyld_add_callback_count() == 1);
+    CHECK(stub_dyld_remove_callback_count() == 1);
+    CHECK(locked_dyld_calls == 0);
+    stub_dyld_set_observer(NULL);
+}
+
+static _Atomic bool loader_done;
+
+// 模拟其他线程不断 dlopen/dlclose：回调在加载锁内等待 fishhook 的锁
+static void *load_and_unload(void *arg) {
+    struct fake_image *image = (struct fake_image *)arg;
+    for (int i = 0; i < 300; i++) {
+        add(image, "churn");
+        stub_dyld_remove_image((const struct mach_header *)fake_header(image));
+    }
+    loader_done = true;
+    return NULL;
+}
+
+static void on_timeout(int signal) {
+    (void)signal;
+    static const char message[] = "test_locking.c: FAIL (deadlock)\n";
+    write(STDERR_FILENO, message, sizeof(message) - 1);
+    _exit(1);
+}
+
+static void test_concurrent_loads(void) {
+    static struct fake_image churn;
+    static struct rebinding rebindings[300];
+    build(&churn);
+    pthread_t thread;
+    CHECK(pthread_create(&thread, NULL, load_and_unload, &churn) == 0);
+    for (int i = 0; i < 300 && !loader_done; i++) {
+        rebindings[i] = (struct rebinding) { "unmatched", VALUE(0x1000 + i), NULL };
+        CHECK(rebind_symbols(&rebindings[i], 1) == 0);
+    }
+    pthread_join(thread, NULL);
+    add(&churn, "churn");
+    CHECK(fake_slots(&churn)[0] == VALUE(0xc1));
+}
+
+static pthread_mutex_t holder_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t holder_cond = PTHREAD_COND_INITIALIZER;
+static int holder_state;                // 1：已持有锁，2：可以释放
+
+static void *hold_rebindings_lock(void *arg) {
+    (void)arg;
+    lock_rebindings();
+    pthread_mutex_lock(&holder_mutex);
+    holder_state = 1;
+    pthread_cond_broadcast(&holder_cond);
+    while (holder_state != 2) {
+        pthread_cond_wait(&holder_cond, &holder_mutex);
+    }
+    pthread_mutex_unlock(&holder_mutex);
+    unlock_rebindings();
+    return NULL;
+}
+
+static int child_status(void) {
+    int status = 0;
+    pid_t child = fork();
+    if (child == 0) {
+        struct rebinding rebindings[] = { { "read", VALUE(0x4d), NULL } };
+        int failures = 0;
+        if (_rebindings_torn) {
+            failures += rebind_symbols(rebindings, 1) != -1;
+            failures += rebind_symbols_swap(VALUE(0xc1), VALUE(0xc3)) != -1;
+            failures += rebind_symbols_detach(VALUE(0xc1)) != -1;
+            failures += rebind_symbols_verify(NULL, 0) != -1;
+        } else {
+            failures += rebind_symbols(rebindings, 1) != 0;
+            failures += rebind_symbols_verify(NULL, 0) != 0;
+        }
+        _exit(_rebindings_torn ? 100 + failures : failures);
+    }
+    if (child < 0 || waitpid(child, &status, 0) != child || !WIFEXITED(status)) {
+        return -1;
+    }
+    return WEXITSTATUS(status);
+}
+
+// fork 不再等待 fishhook 的锁；其他线程持有锁时子进程拒绝使用可能不完整的状态
+static void test_fork(void) {
+    CHECK(child_status() == 0);
+    pthread_t thread;
+    CHECK(pthread_create(&thread, NULL, hold_rebindings_lock, NULL) == 0);
+    pthread_mutex_lock(&holder_mutex);
+    while (holder_state != 1) {
+        pthread_cond_wait(&holder_cond, &holder_mutex);
+    }
+    pthread_mutex_unlock(&holder_mutex);
+    CHECK(child_status() == 100);
+    pthread_mutex_lock(&holder_mutex);
+    holder_state = 2;
+    pthread_cond_broadcast(&holder_cond);
+    pthread_mutex_unlock(&holder_mutex);
+    pthread_join(thread, NULL);
+}
+
+int main(void) {
+    signal(SIGALRM, on_timeout);
+    alarm(60);
+    test_no_dyld_calls_under_lock();
+    test_concurrent_loads();
+    test_fork();
+    return TEST_RESULT();
+}
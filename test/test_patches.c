@@ -0,0 +1,177 @@
+/*
+ * Fixtures for the patch log behind rebind_symbols_swap, rebind_symbols_detach,
+ * rebind_symbols_verify and rebind_symbols_rechain: layered rebindings of one
+ * slot, and slots that another library has written over since fishhook
+ * rewrote them.
+ */
+#include "../fishhook.c"
+
+#include <stdio.h>
+#include <sys/mman.h>
+
+#include "fake_image.h"
+#include "test.h"
+
+#define VALUE(x) ((void *)(uintptr_t)(x))
+
+// 模拟其他 hook 库改写 slot，所在页可能已被改回只读
+static void overwrite(void **slot, void *value) {
+    mprotect((void *)((uintptr_t)slot & ~(uintptr_t)(FAKE_PAGE - 1)), FAKE_PAGE, PROT_READ | PROT_WRITE);
+    *slot = value;
+}
+
+static void test_layers(void) {
+    enum { COUNT = 60 };
+    static struct fake_image image;
+    static struct fake_symbol symbols[COUNT];
+    static char names[COUNT][16];
+    static struct rebinding rebindings[COUNT];
+    static void *originals[COUNT];
+    const char *dylibs[] = { "/usr/lib/libSystem.B.dylib" };
+    for (int i = 0; i < COUNT; i++) {
+        snprintf(names[i], sizeof(names[i]), "_f%d", i);
+        symbols[i] = (struct fake_symbol) { names[i], 1 };
+        rebindings[i] = (struct rebinding) { names[i] + 1, VALUE(0x10000 + i % 3), &originals[i] };
+    }
+    void **slots = fake_image_build(&image, symbols, COUNT, dylibs, 1, "__DATA_CONST", S_NON_LAZY_SYMBOL_POINTERS);
+    const struct mach_header *header = (const struct mach_header *)fake_header(&image);
+    intptr_t slide = fake_slide(&image);
+    rebind_symbols_image((void *)header, slide, rebindings, COUNT);
+    for (int i = 0; i < COUNT; i++) {
+        CHECK(slots[i] == VALUE(0x10000 + i % 3));
+        CHECK(originals[i] == VALUE(0x1000 + i));
+    }
+    
+    // f0 上再叠一层：swap 只改写顶层仍为 replacement 的 slot
+    struct rebinding top[] = { { "f0", VALUE(0x20000), NULL } };
+    rebind_symbols_image((void *)header, slide, top, 1);
+    CHECK(rebind_symbols_swap(VALUE(0x10001), VALUE(0x30001)) == 20);
+    for (int i = 1; i < COUNT; i += 3) {
+        CHECK(slots[i] == VALUE(0x30001));
+    }
+    
+    // 下层被摘掉后，还原顶层得到的是下层之前的值
+    CHECK(rebind_symbols_detach(VALUE(0x10000)) == 19);
+    for (int i = 3; i < COUNT; i += 3) {
+        CHECK(slots[i] == VALUE(0x1000 + i));
+    }
+    CHECK(slots[0] == VALUE(0x20000));
+    CHECK(rebind_symbols_detach(VALUE(0x20000)) == 1);
+    CHECK(slots[0] == VALUE(0x1000));
+    CHECK(rebind_symbols_detach(VALUE(0x10000)) == 0);
+    CHECK(slots[0] == VALUE(0x1000));
+    
+    // swap 下层后再还原顶层，slot 中是 swap 之后的值
+    struct rebinding middle[] = { { "f1", VALUE(0x40000), NULL } };
+    void *upper_original = NULL;
+    struct rebinding upper[] = { { "f1", VALUE(0x50000), &upper_original } };
+    rebind_symbols_image((void *)header, slide, middle, 1);
+    rebind_symbols_image((void *)header, slide, upper, 1);
+    CHECK(upper_original == VALUE(0x40000));
+    CHECK(rebind_symbols_swap(VALUE(0x40000), VALUE(0x60000)) == 0);
+    CHECK(upper_original == VALUE(0x60000));
+    CHECK(rebind_symbols_detach(VALUE(0x50000)) == 1);
+    CHECK(slots[1] == VALUE(0x60000));
+    CHECK(rebind_symbols_detach(VALUE(0x60000)) == 1);
+    CHECK(slots[1] == VALUE(0x30001));
+    
+    CHECK(rebind_symbols_detach(VALUE(0x30001)) == 20);
+    CHECK(rebind_symbols_detach(VALUE(0x10002)) == 20);
+    for (int i = 0; i < COUNT; i++) {
+        CHECK(slots[i] == VALUE(0x1000 + i));
+    }
+    CHECK(rebind_symbols_verify(NULL, 0) == 0);
+}
+
+// 被其他库覆盖的 slot：detach 与 swap 不写 slot，但日志必须跟着变
+static void test_drifted(void) {
+    static struct fake_image image;
+    const struct fake_symbol symbols[] = { { "_a", 1 }, { "_b", 1 } };
+    const char *dylibs[] = { "/usr/lib/libSystem.B.dylib" };
+    void **slots = fake_image_build(&image, symbols, 2, dylibs, 1, "__DATA_CONST", S_NON_LAZY_SYMBOL_POINTERS);
+    void *a_original = NULL;
+    void *b_original = NULL;
+    struct rebinding rebindings[] = {
+        { "a", VALUE(0xa0), &a_original },
+        { "b", VALUE(0xb0), &b_original },
+    };
+    rebind_symbols_image(fake_header(&image), fake_slide(&image), rebindings, 2);
+    CHECK(slots[0] == VALUE(0xa0) && slots[1] == VALUE(0xb0));
+    
+    void *foreign_a = image.bytes + 2 * FAKE_PAGE + 64;                      // 位于已扫描的镜像内，可以接回
+    void *foreign_b = image.bytes + 2 * FAKE_PAGE + 80;
+    overwrite(&slots[0], foreign_a);
+    overwrite(&slots[1], foreign_b);
+    struct rebind_drift drifts[2];
+    CHECK(rebind_symbols_verify(drifts, 2) == 2);
+    
+    CHECK(rebind_symbols_detach(VALUE(0xa0)) == 0);
+    CHECK(slots[0] == foreign_a);
+    CHECK(rebind_symbols_swap(VALUE(0xb0), VALUE(0xb1)) == 0);
+    CHECK(slots[1] == foreign_b);
+    
+    // 已摘掉的 replacement 不再报告，也不会被写回；被 swap 的写回新值
+    CHECK(rebind_symbols_verify(drifts, 2) == 1);
+    CHECK(drifts[0].slot == &slots[1] && drifts[0].expected == VALUE(0xb1) && drifts[0].found == foreign_b);
+    CHECK(rebind_symbols_rechain(&slots[0]) == 0);
+    CHECK(rebind_symbols_rechain(&slots[1]) == 1);
+    CHECK(slots[0] == foreign_a);
+    CHECK(a_original == VALUE(0x1000));
+    CHECK(slots[1] == VALUE(0xb1));
+    CHECK(b_original == foreign_b);
+    CHECK(rebind_symbols_verify(NULL, 0) == 0);
+    CHECK(rebind_symbols_detach(VALUE(0xb1)) == 1);
+    CHECK(slots[1] == foreign_b);                                             // 接回后还原到其他 hook
+}
+
+// 接回前猜测覆盖者会不会转发回来；同一个覆盖值只猜一次
+static void test_rechain(void) {
+    static struct fake_image image;
+    const struct fake_symbol symbols[] = { { "_a", 1 }, { "_b", 1 }, { "_c", 1 } };
+    const char *dylibs[] = { "/usr/lib/libSystem.B.dylib" };
+    void **slots = fake_image_build(&image, symbols, 3, dylibs, 1, "__DATA", S_NON_LAZY_SYMBOL_POINTERS);
+    ((struct segment_command_64 *)fake_find_command(&image, LC_SEGMENT_64))->filesize = 64;  // 其余是零填充
+    void *a_original = NULL;
+    struct rebinding rebindings[] = {
+        { "a", VALUE(0xa0), &a_original },
+        { "b", VALUE(0xb0), NULL },
+        { "c", VALUE(0xc0), NULL },
+    };
+    rebind_symbols_image(fake_header(&image), fake_slide(&image), rebindings, 3);
+    void *foreign = image.bytes + 2 * FAKE_PAGE + 64;
+    
+    CHECK(rebind_symbols_rechain(&slots[0]) == 0);                           // 没有被覆盖
+    overwrite(&slots[0], foreign);
+    CHECK(rebind_symbols_rechain(&slots[0]) == 1);
+    CHECK(slots[0] == VALUE(0xa0) && a_original == foreign);
+    
+    // 覆盖者把 0xa0 存在零填充部分（__bss 中的 static 变量）：接回去会成环
+    void *looping = image.bytes + 2 * FAKE_PAGE + 80;
+    overwrite(&slots[0], looping);
+    overwrite(&slots[100], VALUE(0xa0));
+    CHECK(rebind_symbols_rechain(&slots[0]) == 0);
+    CHECK(slots[0] == looping && a_original == foreign);
+    overwrite(&slots[100], NULL);
+    CHECK(rebind_symbols_rechain(&slots[0]) == 0);                           // 沿用对同一个值的结论
+    
+    overwrite(&slots[0], VALUE(0xc0));                                        // 日志中的另一个值
+    CHECK(rebind_symbols_rechain(&slots[0]) == 0);
+    overwrite(&slots[0], VALUE(0xf01));                                       // 不在已扫描的镜像中
+    CHECK(rebind_symbols_rechain(&slots[0]) == 0);
+    overwrite(&slots[1], foreign);                                            // 没有 replaced
+    CHECK(rebind_symbols_rechain(&slots[1]) == 0);
+    CHECK(rebind_symbols_rechain(&slots[5]) == 0);                           // 不在日志中
+    
+    overwrite(&slots[1], VALUE(0xb0));
+    overwrite(&slots[0], looping);                                            // 换过别的值后重新检查
+    CHECK(rebind_symbols_rechain(&slots[0]) == 1);
+    CHECK(slots[0] == VALUE(0xa0) && a_original == looping);
+    CHECK(rebind_symbols_verify(NULL, 0) == 0);
+}
+
+int main(void) {
+    test_layers();
+    test_drifted();
+    test_rechain();
+    return TEST_RESULT();
+}
@@ -0,0 +1,77 @@
+/*
+ * Fixtures for the shared-memory statistics: a failed attach and a read leave
+ * nothing mapped, and a child forked before any rebinding stops writing to
+ * its parent's slot.
+ */
+#include "../fishhook.c"
+
+#include <sys/wait.h>
+
+#include "test.h"
+
+// 共享内存段映射后以 /dev/shm/<name> 出现在 /proc/self/maps 中
+static bool is_mapped(const char *name) {
+    FILE *maps = fopen("/proc/self/maps", "r");
+    char line[512];
+    bool found = false;
+    while (maps && fgets(line, sizeof(line), maps)) {
+        char *path = strstr(line, "/dev/shm");
+        if (path && strncmp(path + strlen("/dev/shm"), name, strlen(name)) == 0) {
+            found = true;
+        }
+    }
+    if (maps) {
+        fclose(maps);
+    }
+    return found;
+}
+
+static void test_failed_attach_unmaps(const char *name) {
+    CHECK(fishhook_stats_attach_shared(name, 0) == -1);                       // 没有可用的槽位
+    CHECK(!is_mapped(name));
+    CHECK(_counters == &_local_counters);
+    shm_unlink(name);
+}
+
+static void test_read_unmaps_whole_file(const char *name) {
+    struct fishhook_stats total;
+    size_t size;
+    struct stats_segment *segment = map_stats_segment(name, 2, true, &size);
+    CHECK(segment != NULL);
+    int fd = shm_open(name, O_RDWR, 0);
+    CHECK(fd >= 0 && ftruncate(fd, 16 * getpagesize()) == 0);                // 文件比槽位需要的大
+    close(fd);
+    CHECK(fishhook_stats_read_shared(name, &total) == 0);
+    if (segment) {
+        munmap(segment, size);
+    }
+    CHECK(!is_mapped(name));
+    shm_unlink(name);
+}
+
+// 只挂载过共享计数、从未重绑定时 fork，子进程也要换用自己的槽位
+static void test_fork_claims_own_slot(const char *name) {
+    CHECK(fishhook_stats_attach_shared(name, 1) == 0);
+    struct stats_counters *parent = _counters;
+    CHECK(parent != &_local_counters);
+    pid_t child = fork();
+    if (child == 0) {
+        _exit(_counters == &_local_counters ? 0 : 1);                        // 槽位已满，退回进程内计数
+    }
+    int status = 0;
+    CHECK(child > 0 && waitpid(child, &status, 0) == child);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    CHECK(_counters == parent);
+    shm_unlink(name);
+}
+
+int main(void) {
+    char names[3][64];
+    for (int i = 0; i < 3; i++) {
+        snprintf(names[i], sizeof(names[i]), "/fishhook-test-%d-%d", (int)getpid(), i);
+    }
+    test_failed_attach_unmaps(names[0]);
+    test_read_unmaps_whole_file(names[1]);
+    test_fork_claims_own_slot(names[2]);
+    return TEST_RESULT();
+}